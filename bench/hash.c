@@ -0,0 +1,162 @@
+// 字符串哈希的微基准：测量 hashString 在不同长度下的速度，
+// 并检查几组典型 key 的哈希值在 Table 使用的位上是否分布均匀，分布不合格时返回 1；
+// 用 bench/run.sh word= fnv=-DNO_WORD_HASH 对比两种哈希函数
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+#define KEY_COUNT (64 * 1024)
+#define KEY_MAX_LENGTH 48
+// 吞吐量测试中每种长度哈希的总字节数
+#define HASHED_BYTES (64 * 1024 * 1024)
+#define BUFFER_SIZE 4096
+
+// 卡方检验的自由度较大时，均匀分布的 chi²/df 接近 1，超过这个值就认为分布不合格
+#define MAX_CHI_SQUARE 1.5
+// 随机的 32 位哈希值中 64K 个 key 的期望碰撞数约为 0.5
+#define MAX_COLLISIONS 8
+
+static char names[KEY_COUNT][KEY_MAX_LENGTH];
+static int lengths[KEY_COUNT];
+static uint32_t hashes[KEY_COUNT];
+static int buckets[KEY_COUNT];
+
+typedef int (*KeyFormat)(char* buffer, int i);
+
+static int sequentialKey(char* buffer, int i) {
+  return sprintf(buffer, "key%d", i);
+}
+
+static int numberKey(char* buffer, int i) {
+  return sprintf(buffer, "%d", i * 1000);
+}
+
+// 类似标识符的短字符串：三个小写字母加一个数字
+static int identifierKey(char* buffer, int i) {
+  return sprintf(buffer, "%c%c%c%d", 'a' + i % 26, 'a' + i / 26 % 26, 'a' + i / 676 % 26, i / 17576);
+}
+
+// 很长的公共前缀，只有结尾几个字符不同
+static int prefixKey(char* buffer, int i) {
+  return sprintf(buffer, "some.rather.long.module.prefix.member_%d", i);
+}
+
+/**
+ * @brief 只看 hash 中 (hash >> shift) & (count - 1) 这几位时的 chi²/df
+ */
+static double chiSquare(int keyCount, int shift, int count) {
+  memset(buckets, 0, sizeof(int) * count);
+  for (int i = 0; i < keyCount; i++) {
+    buckets[(hashes[i] >> shift) & (count - 1)]++;
+  }
+  double expected = (double)keyCount / count;
+  double sum = 0;
+  for (int i = 0; i < count; i++) {
+    double difference = buckets[i] - expected;
+    sum += difference * difference / expected;
+  }
+  return sum / (count - 1);
+}
+
+static int compareHash(const void* a, const void* b) {
+  uint32_t x = *(const uint32_t*)a;
+  uint32_t y = *(const uint32_t*)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * @brief
+ * 用 format 生成一组 key，检查 32 位哈希值的碰撞数，以及 Table 使用的低 7 位（控制字节）
+ * 和其余位（起始组、线性探测的起点）的分布，再把它们全部放进 Table 确认都能找回
+ *
+ * @return bool 是否合格
+ */
+static bool checkKeys(const char* name, KeyFormat format) {
+  for (int i = 0; i < KEY_COUNT; i++) {
+    lengths[i] = format(names[i], i);
+    hashes[i] = hashString(names[i], lengths[i]);
+  }
+
+  double tag = chiSquare(KEY_COUNT, 0, 128);
+  double group = chiSquare(KEY_COUNT, 7, 1024);
+  double low = chiSquare(KEY_COUNT, 0, 4096);
+
+  Table table;
+  initTable(&table);
+  for (int i = 0; i < KEY_COUNT; i++) {
+    tableSet(&table, copyString(names[i], lengths[i]), NUMBER_VAL(i));
+  }
+  int found = 0;
+  for (int i = 0; i < KEY_COUNT; i++) {
+    Value value;
+    ObjString* key = copyString(names[i], lengths[i]);
+    if (tableGet(&table, key, &value) && AS_NUMBER(value) == i) found++;
+  }
+  freeTable(&table);
+
+  qsort(hashes, KEY_COUNT, sizeof(uint32_t), compareHash);
+  int collisions = 0;
+  for (int i = 1; i < KEY_COUNT; i++) {
+    if (hashes[i] == hashes[i - 1]) collisions++;
+  }
+
+  bool passed = tag < MAX_CHI_SQUARE && group < MAX_CHI_SQUARE && low < MAX_CHI_SQUARE &&
+                collisions <= MAX_COLLISIONS && found == KEY_COUNT;
+  printf("%-12s tag %.2f  group %.2f  low %.2f  collisions %d  %s\n",
+         name, tag, group, low, collisions, passed ? "ok" : "FAIL");
+  return passed;
+}
+
+/**
+ * @brief 反复哈希 length 字节的子串，起点在缓冲区中移动，避免每次都是对齐的地址
+ */
+static double measure(const char* buffer, int length) {
+  long count = HASHED_BYTES / length;
+  uint32_t sink = 0;
+  clock_t start = clock();
+  for (long i = 0; i < count; i++) {
+    sink += hashString(buffer + (i & 63), length);
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("%-5d bytes %8.4fs %8.2f ns/hash (%u)\n",
+         length, seconds, seconds * 1e9 / count, sink);
+  return seconds;
+}
+
+int main() {
+  initVM();
+  // key 只被 C 数组和 Table 引用，调大阈值让测量期间不发生回收
+  GCConfig config;
+  initGCConfig(&config);
+  config.initialHeap = (size_t)1 << 40;
+  configureGC(&config);
+
+  bool passed = true;
+  passed &= checkKeys("sequential", sequentialKey);
+  passed &= checkKeys("number", numberKey);
+  passed &= checkKeys("identifier", identifierKey);
+  passed &= checkKeys("prefix", prefixKey);
+
+  static char buffer[BUFFER_SIZE + 64];
+  for (int i = 0; i < BUFFER_SIZE + 64; i++) {
+    buffer[i] = (char)('a' + (i * 7) % 26);
+  }
+  static const int sizes[] = {3, 8, 16, 32, 64, 256, BUFFER_SIZE};
+  double total = 0;
+  for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+    total += measure(buffer, sizes[i]);
+  }
+
+  freeVM();
+
+  // 和 bench/*.lox 一样，最后一行输出总耗时
+  printf("%g\n", total);
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,45 @@
+#!/bin/sh
+# 用不同的编译选项分别构建 clox，并对比 bench/ 下脚本的耗时
+#
+# 用法: bench/run.sh [变体名=CFLAGS ...]
+# 默认对比 computed goto 与 switch 两种指令分发方式，例如：
+#   bench/run.sh goto= switch=-DNO_COMPUTED_GOTO
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${BUILD_DIR:-$ROOT/build-bench}
+RUNS=${RUNS:-3}
+
+if [ $# -eq 0 ]; then
+  set -- goto= switch=-DNO_COMPUTED_GOTO
+fi
+
+for variant in "$@"; do
+  name=${variant%%=*}
+  flags=${variant#*=}
+  cmake -S "$ROOT" -B "$BUILD/$name" -DCMAKE_BUILD_TYPE=Release \
+      -DCMAKE_C_FLAGS="$flags" > /dev/null
+  cmake --build "$BUILD/$name" > /dev/null
+done
+
+# table-bench 和 hash-bench 是 C 写的微基准，和脚本一样最后一行输出耗时
+for script in "$ROOT"/bench/*.lox table-bench hash-bench; do
+  echo "$(basename "$script")"
+  for variant in "$@"; do
+    name=${variant%%=*}
+    best=
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+      # 脚本最后一行输出的是 clock() 计时
+      if [ "$script" = table-bench ] || [ "$script" = hash-bench ]; then
+        t=$("$BUILD/$name/bin/$script" | tail -n 1)
+      else
+        t=$("$BUILD/$name/bin/clox" "$script" | tail -n 1)
+      fi
+      best=$(awk -v t="$t" -v b="$best" 'BEGIN { print (b == "" || t < b) ? t : b }')
+      i=$((i + 1))
+    done
+    printf "  %-12s %ss\n" "$name" "$best"
+  done
+done
@@ -0,0 +1,147 @@
+// 哈希表的微基准：直接调用 Table 的接口，分别测量命中、未命中、小表、插入删除和字符串查找，
+// 用 bench/run.sh swiss= linear=-DNO_SWISS_TABLE 对比两种探测方式
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+// 大表中 key 的数量，相当于一个很大的字符串驻留表
+#define LARGE_KEYS (64 * 1024)
+// 小表中 key 的数量，相当于常见的方法表和字段表
+#define SMALL_KEYS 8
+#define SMALL_TABLES 1024
+// 只有几个 key 的表，开启 SMALL_TABLE 时条目内联保存在 Table 中
+#define TINY_KEYS 3
+#define ROUNDS 128
+
+static ObjString* keys[LARGE_KEYS];
+static ObjString* missingKeys[LARGE_KEYS];
+static char names[LARGE_KEYS][16];
+
+/**
+ * @brief 输出一项测量的耗时，返回耗时用于累加
+ */
+static double report(const char* name, clock_t start, long sink) {
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("%-12s %8.4fs (%ld)\n", name, seconds, sink);
+  return seconds;
+}
+
+int main() {
+  initVM();
+  // 基准中的 key 只被 C 数组引用，GC 看不到它们，调大阈值让测量期间不发生回收
+  GCConfig config;
+  initGCConfig(&config);
+  config.initialHeap = (size_t)1 << 40;
+  configureGC(&config);
+
+  for (int i = 0; i < LARGE_KEYS; i++) {
+    int length = sprintf(names[i], "key%d", i);
+    keys[i] = copyString(names[i], length);
+    char missing[16];
+    length = sprintf(missing, "missing%d", i);
+    missingKeys[i] = copyString(missing, length);
+  }
+
+  Table large;
+  initTable(&large);
+  for (int i = 0; i < LARGE_KEYS; i++) {
+    tableSet(&large, keys[i], NUMBER_VAL(i));
+  }
+
+  static Table small[SMALL_TABLES];
+  static Table tiny[SMALL_TABLES];
+  for (int t = 0; t < SMALL_TABLES; t++) {
+    initTable(&small[t]);
+    for (int i = 0; i < SMALL_KEYS; i++) {
+      tableSet(&small[t], keys[(t * SMALL_KEYS + i) % LARGE_KEYS], NUMBER_VAL(i));
+    }
+    initTable(&tiny[t]);
+    for (int i = 0; i < TINY_KEYS; i++) {
+      tableSet(&tiny[t], keys[(t * TINY_KEYS + i) % LARGE_KEYS], NUMBER_VAL(i));
+    }
+  }
+
+  double total = 0;
+  long sink = 0;
+  Value value;
+
+  // 按照和插入不同的顺序访问，避免顺序访问掩盖缓存缺失
+  clock_t start = clock();
+  for (int round = 0; round < ROUNDS; round++) {
+    for (int i = 0; i < LARGE_KEYS; i++) {
+      int index = (int)(((unsigned)i * 40503u) % LARGE_KEYS);
+      if (tableGet(&large, keys[index], &value)) sink += (long)AS_NUMBER(value);
+    }
+  }
+  total += report("get hit", start, sink);
+
+  sink = 0;
+  start = clock();
+  for (int round = 0; round < ROUNDS; round++) {
+    for (int i = 0; i < LARGE_KEYS; i++) {
+      if (!tableGet(&large, missingKeys[i], &value)) sink++;
+    }
+  }
+  total += report("get miss", start, sink);
+
+  sink = 0;
+  start = clock();
+  for (int round = 0; round < ROUNDS * 16; round++) {
+    for (int t = 0; t < SMALL_TABLES; t++) {
+      ObjString* key = keys[(t * SMALL_KEYS + round % SMALL_KEYS) % LARGE_KEYS];
+      if (tableGet(&small[t], key, &value)) sink += (long)AS_NUMBER(value);
+    }
+  }
+  total += report("small get", start, sink);
+
+  sink = 0;
+  start = clock();
+  for (int round = 0; round < ROUNDS * 16; round++) {
+    for (int t = 0; t < SMALL_TABLES; t++) {
+      ObjString* key = keys[(t * TINY_KEYS + round % TINY_KEYS) % LARGE_KEYS];
+      if (tableGet(&tiny[t], key, &value)) sink += (long)AS_NUMBER(value);
+    }
+  }
+  total += report("tiny get", start, sink);
+
+  // 反复删除再插入一半的 key，探测时需要越过墓碑
+  sink = 0;
+  start = clock();
+  for (int round = 0; round < ROUNDS / 4; round++) {
+    for (int i = round % 2; i < LARGE_KEYS; i += 2) {
+      sink += tableDelete(&large, keys[i]);
+    }
+    for (int i = round % 2; i < LARGE_KEYS; i += 2) {
+      sink += tableSet(&large, keys[i], NUMBER_VAL(i));
+    }
+  }
+  total += report("churn", start, sink);
+
+  // 字符串驻留：用字符内容查找
+  sink = 0;
+  start = clock();
+  for (int round = 0; round < ROUNDS / 4; round++) {
+    for (int i = 0; i < LARGE_KEYS; i++) {
+      ObjString* key = keys[i];
+      if (tableFindString(&vm.strings, names[i], key->length, key->hash) == key) sink++;
+    }
+  }
+  total += report("find string", start, sink);
+
+  for (int t = 0; t < SMALL_TABLES; t++) {
+    freeTable(&small[t]);
+    freeTable(&tiny[t]);
+  }
+  freeTable(&large);
+  freeVM();
+
+  // 和 bench/*.lox 一样，最后一行输出总耗时
+  printf("%g\n", total);
+  return 0;
+}
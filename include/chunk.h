@@ -20,6 +20,9 @@ typedef enum {
   OP_GET_PROPERTY,
   OP_SET_PROPERTY,
   OP_GET_SUPER,
+  OP_BUILD_LIST,
+  OP_INDEX_GET,
+  OP_INDEX_SET,
   OP_EQUAL,
   OP_GREATER,
   OP_LESS,
@@ -44,6 +47,30 @@ typedef enum {
   OP_METHOD
 } OpCode;
 
+// 每个内联缓存最多记录的接收者类型数，超过后不再缓存新的类型（超态）
+#define INLINE_CACHE_ENTRIES 4
+
+/**
+ * @brief 内联缓存的一个条目，以接收者的 shape 为 key；
+ * 每个类有自己的根 shape，所以 shape 相同也意味着类相同
+ */
+typedef struct {
+  struct ObjShape* shape; // 接收者的 shape
+  struct ObjShape* transition; // 写入新字段后迁移到的 shape，只用于 OP_SET_PROPERTY
+  int index; // 字段在实例 fields 数组中的下标，缓存的是方法时为 -1
+  struct ObjClosure* method; // 缓存的方法，缓存的是字段时为 NULL
+} InlineCacheEntry;
+
+/**
+ * @brief 属性访问 / 方法调用指令的内联缓存，每个调用点一个
+ */
+typedef struct {
+  int count; // 已使用的条目数，1 为单态，大于 1 为多态
+  InlineCacheEntry entries[INLINE_CACHE_ENTRIES];
+  uint64_t hits; // 命中次数
+  uint64_t misses; // 未命中次数
+} InlineCache;
+
 /**
  * @brief 动态数组，用于存储字节码
  */
@@ -53,6 +80,9 @@ typedef struct {
   uint8_t* code; // 数组指针
   int* lines; // 行号数组指针，与 code 等长
   ValueArray constants; // 常量数组
+  int cacheCount; // 内联缓存数量
+  int cacheCapacity; // 内联缓存数组容量
+  InlineCache* caches; // 内联缓存数组，由指令中的 2 字节下标引用
 } Chunk;
 
 /**
@@ -83,5 +113,12 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line);
  * @return int 常量值位于数组的 index
  */
 int addConstant(Chunk* chunk, Value value);
+/**
+ * @brief 为一个调用点添加空的内联缓存
+ * 
+ * @param chunk Chunk指针
+ * @return int 内联缓存位于数组的 index
+ */
+int addInlineCache(Chunk* chunk);
 
 #endif
\ No newline at end of file
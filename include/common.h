@@ -5,11 +5,97 @@
 #include <stddef.h>
 #include <stdint.h>
 
-// #define NAN_BOXING
 #define DEBUG_PRINT_CODE
 // #define DEBUG_STRESS_GC
 // #define DEBUG_LOG_GC
 // #define DEBUG_TRACE_EXECUTION
+// #define DEBUG_LOG_IC
+
+// NaN boxing：Value 压缩成 8 字节，数字直接保存为 double，nil、布尔值和对象指针放在 quiet NaN 的空闲位中；
+// 定义 NO_NAN_BOXING（或者 cmake -DCLOX_NAN_BOXING=OFF）可以退回 16 字节的带类型标签的结构体
+#ifndef NO_NAN_BOXING
+#define NAN_BOXING
+#endif
+
+// 小整数：能用 int32_t 表示的整数字面量和整数运算结果带单独的标签，VM 按整数计算，
+// 溢出时提升为 double，输出和比较的结果与 double 完全一致；定义 NO_SMALL_INT 可以退回全部使用 double
+#ifndef NO_SMALL_INT
+#define SMALL_INT
+#endif
+
+// 字符串拼接的结果先保存为 rope，需要连续的字符时才展开，循环中拼接字符串不再是 O(n²)；
+// 定义 NO_ROPE_STRING 可以退回每次拼接都复制两边的字符
+#ifndef NO_ROPE_STRING
+#define ROPE_STRING
+#endif
+
+// substring() 和 split() 返回的较长子串是切片，直接引用原字符串中的字符，不复制也不计算哈希值；
+// 定义 NO_SLICE_STRING 可以退回每个子串都复制
+#ifndef NO_SLICE_STRING
+#define SLICE_STRING
+#endif
+
+// 字符串哈希每次处理 8 字节（wyhash 的算法），短字符串只需要几次读取和两次 128 位乘法；
+// 定义 NO_WORD_HASH 可以退回逐字节计算的 FNV-1a
+#ifndef NO_WORD_HASH
+#define WORD_HASH
+#endif
+
+// 支持 labels-as-values 的编译器（GCC / Clang）使用 computed goto 分发指令，
+// 定义 NO_COMPUTED_GOTO 可以强制退回 switch 分发
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
+
+// #define DEBUG_LOG_GC_PAUSE
+
+// 增量回收：标记和清除拆成有停顿预算的片段，穿插在内存分配中执行；
+// 与分代回收互斥，开启后不再区分新生代和老年代
+// #define GC_INCREMENTAL
+
+// 并发标记：沿用增量回收的阶段划分，标记交给后台线程执行，
+// VM 只在扫描根集合和最后的重新标记时停顿；写屏障换成 SATB
+// #define GC_CONCURRENT
+#if defined(GC_CONCURRENT) && !defined(GC_INCREMENTAL)
+#define GC_INCREMENTAL
+#endif
+
+// 分代回收：平时只回收新分配的对象，老年代增长到阈值后才做完整回收，
+// 定义 NO_GC_GENERATIONAL 可以退回每次都做完整的标记-清除
+#if !defined(NO_GC_GENERATIONAL) && !defined(GC_INCREMENTAL)
+#define GC_GENERATIONAL
+#endif
+
+// 延迟清除：完整回收只做标记，分配器用完空闲块时再逐页清除，
+// 停顿只剩标记阶段；定义 NO_GC_LAZY_SWEEP 可以退回标记后立即清除整个堆。
+// 增量回收有自己的清除片段，不使用延迟清除
+#if !defined(NO_GC_LAZY_SWEEP) && !defined(GC_INCREMENTAL)
+#define GC_LAZY_SWEEP
+#endif
+
+// 完整回收时清除对象页的线程数，包括 VM 线程自己，大于 1 时并行清除；
+// 增量回收按片段清除，不使用这个设置
+#ifndef GC_SWEEP_WORKERS
+#define GC_SWEEP_WORKERS 1
+#endif
+
+// 哈希表按 SwissTable 的方式探测：单独的控制字节数组保存每个槽位的哈希片段，
+// 一次比较一组 16 个槽位，支持 SSE2 时用 SIMD 指令比较；
+// 定义 NO_SWISS_TABLE 可以退回逐个比较 key 的线性探测
+#ifndef NO_SWISS_TABLE
+#define SWISS_TABLE
+#endif
+
+// 条目很少的哈希表把 key 和 value 直接保存在 Table 中，按指针逐个比较 key，
+// 省去一次分配和一次缓存缺失；定义 NO_SMALL_TABLE 可以退回总是分配哈希表
+#ifndef NO_SMALL_TABLE
+#define SMALL_TABLE
+#endif
+
+// 小对象按尺寸类从内存池分配，定义 NO_POOL_ALLOCATOR 可以退回直接使用 malloc
+#ifndef NO_POOL_ALLOCATOR
+#define POOL_ALLOCATOR
+#endif
 
 #define UINT8_COUNT (UINT8_MAX + 1)
 
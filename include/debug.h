@@ -1,7 +1,10 @@
 #ifndef clox_debug_h
 #define clox_debug_h
 
+#include <stdio.h>
+
 #include "chunk.h"
+#include "vm.h"
 
 /**
  * @brief 将字节码反编译出来，输出可阅读的指令
@@ -20,4 +23,30 @@ void disassembleChunk(Chunk* chunk, const char* name);
  */
 int disassembleInstruction(Chunk* chunk, int offset);
 
+/**
+ * @brief 遍历堆上所有函数，输出每个内联缓存的命中率以及总命中率
+ */
+void printInlineCacheStats();
+
+/**
+ * @brief 输出 GC 停顿的次数、总时长和最长的一次停顿
+ */
+void printGCPauseStats();
+
+/**
+ * @brief 对象类型的名字，用于统计数据的输出
+ * 
+ * @param type 
+ * @return const char* 复数形式的小驼峰名字，例如 "boundMethods"
+ */
+const char* objTypeName(ObjType type);
+
+/**
+ * @brief 把 GC 统计数据按 JSON 格式写入 file，时间的单位是纳秒
+ * 
+ * @param file 
+ * @param stats readGCStats 取得的快照
+ */
+void writeGCStatsJSON(FILE* file, const GCStats* stats);
+
 #endif
@@ -3,6 +3,8 @@
 
 #include "common.h"
 #include "object.h"
+#include "pool.h"
+#include "vm.h"
 
 #define ALLOCATE(type, count) \
     (type*)reallocate(NULL, 0, sizeof(type) * (count))
@@ -12,6 +14,8 @@
 
 #define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
 
+#define FREE_OBJ(type, object) freeObjectMemory((Obj*)(object), sizeof(type))
+
 // type* + void* = 泛型
 #define GROW_ARRAY(type, pointer, oldCount, newCount) \
     (type*)reallocate(pointer, sizeof(type) * (oldCount), sizeof(type) * (newCount))
@@ -19,18 +23,95 @@
 #define FREE_ARRAY(type, pointer, oldCount) \
     reallocate(pointer, sizeof(type) * (oldCount), 0)
 
+// 增量回收每个片段默认的停顿预算，单位纳秒
+#define GC_SLICE_BUDGET (500 * 1000)
+// 第一次回收的默认阈值
+#define GC_INITIAL_HEAP (1024 * 1024)
+// 默认的堆增长系数：完整回收之后，下一次回收的阈值是存活内存的这么多倍
+#define GC_HEAP_GROW_FACTOR 2.0
+
 /**
  * @brief 
  * 封装的 free() 和 realloc() ；
  * newSize=0 时使用 free 清理内存，
- * 否则按照 newSize 调用 realloc，分配内存失败时 exit(1)
+ * 否则按照 newSize 调用 realloc，系统分配内存失败时 exit(1)；
+ * 开启 POOL_ALLOCATOR 时小块内存由内存池按尺寸类管理。
+ * 超过 vm.gcConfig.heapLimit 时先做一次完整回收，仍然超过就设置 vm.heapExhausted，
+ * 这次分配照常完成，由 VM 在下一个安全点报运行时错误
  * 
  * @param pointer 需要分配内存的指针，新建时传 NULL
- * @param oldSize TBD
+ * @param oldSize 原来的大小，必须和分配时的 newSize 一致
  * @param newSize 需要的内存大小
  * @return realloc 返回的 void* 指针
  */
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+
+/**
+ * @brief 
+ * 分配 GC 管理的对象内存，和 reallocate 一样计入 vm.bytesAllocated 并可能触发 GC；
+ * 只初始化对象头部中 GC 相关的字段
+ * 
+ * @param size 对象大小
+ * @return Obj* 
+ */
+Obj* allocateObjectMemory(size_t size);
+
+/**
+ * @brief 释放 allocateObjectMemory 分配的对象内存
+ * 
+ * @param object 
+ * @param size 分配时的大小
+ */
+void freeObjectMemory(Obj* object, size_t size);
+
+/**
+ * @brief 对象是否已经被标记
+ */
+static inline bool isMarked(Obj* object) {
+#ifdef GC_CONCURRENT
+  if (object->isLarge) {
+    return __atomic_load_n(&poolLargeOf(object)->isMarked, __ATOMIC_RELAXED);
+  }
+#else
+  if (object->isLarge) return poolLargeOf(object)->isMarked;
+#endif
+  return poolIsMarked(object);
+}
+
+/**
+ * @brief 标记对象
+ */
+static inline void setMarked(Obj* object) {
+  if (object->isLarge) {
+#ifdef GC_CONCURRENT
+    __atomic_store_n(&poolLargeOf(object)->isMarked, true, __ATOMIC_RELAXED);
+#else
+    poolLargeOf(object)->isMarked = true;
+#endif
+  } else {
+    poolSetMarked(object);
+  }
+}
+
+/**
+ * @brief 按页遍历堆上所有对象的游标
+ */
+typedef struct {
+  PoolPage* page;
+  int word;
+  uint64_t bits; // 当前位图字中还没有访问的对象
+  LargeObject* large;
+} HeapIterator;
+
+void initHeapIterator(HeapIterator* iterator);
+
+/**
+ * @brief 
+ * 返回下一个对象，遍历结束时返回 NULL；
+ * 游标已经越过返回的对象，遍历过程中可以释放它
+ */
+Obj* nextHeapObject(HeapIterator* iterator);
+
 void markObject(Obj* object);
 /**
  * @brief 将当前 Value 标记为正在被引用
@@ -39,6 +120,150 @@ void markObject(Obj* object);
  */
 void markValue(Value value);
 void collectGarbage();
+/**
+ * @brief 
+ * 把回收阈值限制在 vm.gcConfig 的 [minHeap, maxHeap] 之间；
+ * 存活内存已经接近 maxHeap 时仍然保留一点余量
+ * 
+ * @param threshold 按增长系数计算出的阈值
+ * @param live 当前存活的内存
+ * @return size_t 
+ */
+size_t clampThreshold(size_t threshold, size_t live);
+/**
+ * @brief 复制一份 GC 统计数据，并发标记时后台线程也会更新其中的计时
+ * 
+ * @param stats 
+ */
+void readGCStats(GCStats* stats);
+/**
+ * @brief 
+ * 将老年代对象加入记忆集，下一次新生代回收时重新扫描它；
+ * 增量回收时则是把黑色对象重新压入灰色栈
+ * 
+ * @param object 
+ */
+void rememberObject(Obj* object);
+
+/**
+ * @brief 写屏障中需要读取标记位图的部分
+ * 
+ * @param object 被写入的对象
+ * @param value 写入的对象
+ */
+void writeBarrierSlow(Obj* object, Obj* value);
+
+/**
+ * @brief 
+ * 并发标记时修改 object 之前调用：object 在本轮还没有被扫描时，
+ * 先在 VM 线程上扫描它，后台线程正在扫描它时等待扫描结束
+ * 
+ * @param object 即将被修改的对象
+ */
+void scanBeforeWrite(Obj* object);
+
+/**
+ * @brief 
+ * 并发标记的安全点：有等待开始的回收请求时，扫描根集合并把标记交给后台线程；
+ * 只在字节码指令之间调用，此时没有修改到一半的对象
+ */
+void beginConcurrentMark();
+
+#ifdef GC_CONCURRENT
+/**
+ * @brief 
+ * SATB 写屏障：修改一个已有对象之前调用，保证后台线程看到的是它在本轮开始时的内容，
+ * 被覆盖的引用也都已经标记；标记阶段分配的对象本身就视为已经扫描过
+ * 
+ * @param object 即将被修改的对象
+ */
+static inline void preWriteBarrier(Obj* object) {
+  if (vm.gcPhase == GC_PHASE_MARK &&
+      __atomic_load_n(&object->scanEpoch, __ATOMIC_ACQUIRE) != vm.gcEpoch) {
+    scanBeforeWrite(object);
+  }
+}
+
+/**
+ * @brief 
+ * 从字符串驻留表这样的弱引用表中重新取出对象时调用：
+ * 它可能不在本轮开始时的快照中，标记阶段需要把它标记为灰色
+ * 
+ * @param object 取出的对象
+ */
+static inline void shadeObject(Obj* object) {
+  if (vm.gcPhase == GC_PHASE_MARK) markObject(object);
+}
+#else
+// 不需要屏障时也对参数求值，只为屏障准备的局部变量不会被报告为未使用
+#define preWriteBarrier(object) ((void)(object))
+#define shadeObject(object) ((void)(object))
+#endif
+
+#ifdef GC_CONCURRENT
+// SATB 写屏障在写入之前处理，写入之后不需要再做什么
+#define writeBarrier(object, value) ((void)(object), (void)(value))
+#define writeBarrierObject(object) ((void)(object))
+#elif defined(GC_GENERATIONAL)
+/**
+ * @brief 
+ * 写屏障：向 object 写入 value 之后调用，
+ * 老年代对象引用了新生代对象时，将它加入记忆集
+ * 
+ * @param object 被写入的对象
+ * @param value 写入的值
+ */
+static inline void writeBarrier(Obj* object, Value value) {
+  // 只有写入对象并且 object 不在记忆集中时才需要去读位图，放在函数外面保持调用点精简
+  if (IS_OBJ(value) && !object->isRemembered) {
+    writeBarrierSlow(object, AS_OBJ(value));
+  }
+}
+
+/**
+ * @brief 
+ * 整体复制哈希表等无法逐个检查写入值的场景使用，
+ * 只要 object 是老年代就加入记忆集
+ * 
+ * @param object 被写入的对象
+ */
+static inline void writeBarrierObject(Obj* object) {
+  if (!object->isRemembered && isMarked(object)) {
+    rememberObject(object);
+  }
+}
+#elif defined(GC_INCREMENTAL)
+/**
+ * @brief 
+ * 写屏障：标记阶段向已标记的对象写入未标记的对象时，将写入的对象标记为灰色，
+ * 保证黑色对象不会指向白色对象
+ * 
+ * @param object 被写入的对象
+ * @param value 写入的值
+ */
+static inline void writeBarrier(Obj* object, Value value) {
+  if (vm.gcPhase == GC_PHASE_MARK && isMarked(object) &&
+      IS_OBJ(value) && !isMarked(AS_OBJ(value))) {
+    markObject(AS_OBJ(value));
+  }
+}
+
+/**
+ * @brief 
+ * 整体复制哈希表等无法逐个检查写入值的场景使用，
+ * 标记阶段把已标记的 object 重新变灰
+ * 
+ * @param object 被写入的对象
+ */
+static inline void writeBarrierObject(Obj* object) {
+  if (vm.gcPhase == GC_PHASE_MARK && isMarked(object)) {
+    rememberObject(object);
+  }
+}
+#else
+#define writeBarrier(object, value) ((void)(object), (void)(value))
+#define writeBarrierObject(object) ((void)(object))
+#endif
 /**
  * @brief
  * 释放 VM 中所有的 Obj 对象内存
@@ -13,7 +13,9 @@
 #define IS_CLOSURE(value)      isObjType(value, OBJ_CLOSURE)
 #define IS_FUNCTION(value)     isObjType(value, OBJ_FUNCTION)
 #define IS_INSTANCE(value)     isObjType(value, OBJ_INSTANCE)
+#define IS_LIST(value)         isObjType(value, OBJ_LIST)
 #define IS_NATIVE(value)       isObjType(value, OBJ_NATIVE)
+#define IS_SHAPE(value)        isObjType(value, OBJ_SHAPE)
 #define IS_STRING(value)       isObjType(value, OBJ_STRING)
 
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))
@@ -21,9 +23,10 @@
 #define AS_CLOSURE(value)      ((ObjClosure*)AS_OBJ(value))
 #define AS_FUNCTION(value)     ((ObjFunction*)AS_OBJ(value))
 #define AS_INSTANCE(value)     ((ObjInstance*)AS_OBJ(value))
+#define AS_LIST(value)         ((ObjList*)AS_OBJ(value))
 #define AS_NATIVE(value)       (((ObjNative*)AS_OBJ(value))->function)
+#define AS_SHAPE(value)        ((ObjShape*)AS_OBJ(value))
 #define AS_STRING(value)       ((ObjString*)AS_OBJ(value))
-#define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->chars)
 
 typedef enum {
   OBJ_BOUND_METHOD,
@@ -31,15 +34,29 @@ typedef enum {
   OBJ_CLOSURE,
   OBJ_FUNCTION,
   OBJ_INSTANCE,
+  OBJ_LIST,
   OBJ_NATIVE,
+  OBJ_SHAPE,
   OBJ_STRING,
   OBJ_UPVALUE
 } ObjType;
 
+// 对象类型的数量，新增类型时要一起修改
+#define OBJ_TYPE_COUNT (OBJ_UPVALUE + 1)
+
+/**
+ * @brief 
+ * 所有对象的头部；GC 标记存放在对象所在页的位图中，
+ * 对象也不再串成链表，由 GC 按页遍历
+ */
 struct Obj {
   ObjType type;
-  bool isMarked;
-  struct Obj* next;
+  // 是否已经在记忆集中
+  bool isRemembered;
+  // 超过 POOL_MAX_SIZE 的大对象，标记存放在 LargeObject 头部
+  bool isLarge;
+  // 并发标记时最后一次扫描这个对象的轮次，扫描过程中带有忙标志
+  uint8_t scanEpoch;
 };
 
 typedef struct {
@@ -57,13 +74,68 @@ typedef struct {
   NativeFn function;
 } ObjNative;
 
+/**
+ * @brief 字符串的存储方式
+ */
+typedef enum {
+  STRING_FLAT, // 字符和头部一起分配，以 '\0' 结尾
+  STRING_ROPE, // 按 ObjRope 分配，拼接的结果
+  STRING_SLICE // 按 ObjSlice 分配，指向另一个字符串中的一段字符
+} StringKind;
+
+/**
+ * @brief 
+ * 字符串：字符以 '\0' 结尾，和头部一起分配，比较字符时不需要再跳转一次指针；
+ * kind 不是 STRING_FLAT 时实际分配的是 ObjRope 或 ObjSlice，没有 chars，
+ * 需要连续的字符时用 stringChars() 读取
+ */
 struct ObjString {
   Obj obj;
   int length;
-  char* chars;
-  uint32_t hash;
+  uint32_t hash; // hashed 为 true 时有效，没有进入驻留表的字符串第一次需要时才计算，见 stringHash
+  uint8_t kind; // StringKind
+  bool hashed;
+  bool interned; // 在字符串驻留表中，内容相同的驻留字符串一定是同一个对象
+  char chars[];
 };
 
+/**
+ * @brief 
+ * 字符串拼接的结果：只记录左右两段，第一次需要连续的字符时才展开，
+ * 展开的结果是一个新的字符串，之后不再引用左右两段；rope 不进入字符串驻留表，
+ * 作为哈希表的 key 之前要先用 internString 驻留
+ */
+typedef struct {
+  // 和 ObjString 相同的头部
+  Obj obj;
+  int length;
+  uint32_t hash;
+  uint8_t kind;
+  bool hashed;
+  bool interned;
+  ObjString* left;
+  ObjString* right;
+  ObjString* flat; // 展开之后的字符串，还没有展开时为 NULL
+} ObjRope;
+
+/**
+ * @brief 
+ * 子串：直接引用 parent 中从 start 开始的 length 个字符，不复制字符；
+ * parent 总是 STRING_FLAT，切片存活时 parent 也一直存活。
+ * 切片不以 '\0' 结尾，不进入字符串驻留表，作为哈希表的 key 之前要先用 internString 驻留
+ */
+typedef struct {
+  // 和 ObjString 相同的头部
+  Obj obj;
+  int length;
+  uint32_t hash;
+  uint8_t kind;
+  bool hashed;
+  bool interned;
+  ObjString* parent;
+  int start;
+} ObjSlice;
+
 typedef struct ObjUpvalue {
   Obj obj;
   Value* location;
@@ -71,23 +143,41 @@ typedef struct ObjUpvalue {
   struct ObjUpvalue* next;
 } ObjUpvalue;
 
-typedef struct {
+typedef struct ObjClosure {
   Obj obj;
   ObjFunction* function;
   ObjUpvalue** upvalues;
   int upvalueCount;
 } ObjClosure;
 
-typedef struct {
+/**
+ * @brief 隐藏类：记录实例有哪些字段，以及每个字段在 fields 数组中的下标；
+ * 以相同顺序添加字段的实例共享同一个 shape
+ */
+typedef struct ObjShape {
+  Obj obj;
+  int fieldCount; // 字段数量
+  Table fields; // 字段名 -> 字段下标
+  Table transitions; // 字段名 -> 添加该字段后迁移到的 shape
+} ObjShape;
+
+typedef struct ObjClass {
   Obj obj;
   ObjString* name;
   Table methods;
+  ObjShape* rootShape; // 该类实例的初始 shape（没有任何字段）
+  int fieldHint; // 该类实例出现过的最大字段数，新实例按此预留内联字段槽位
 } ObjClass;
 
 typedef struct {
   Obj obj;
   ObjClass* klass;
-  Table fields; 
+  ObjShape* shape;
+  Value* fields; // 字段值，下标由 shape 决定；默认指向 inlineFields
+  int capacity; // fields 的容量
+  int inlineCapacity; // 与对象一起分配的内联字段槽位数
+  // 按 Value 的大小对齐，避免字段跨越缓存行
+  _Alignas(sizeof(Value)) Value inlineFields[];
 } ObjInstance;
 
 typedef struct {
@@ -96,14 +186,87 @@ typedef struct {
   ObjClosure* method;
 } ObjBoundMethod;
 
+/**
+ * @brief 列表：元素连续保存在 items 中，下标访问不需要哈希，追加时按倍数扩容
+ */
+typedef struct {
+  Obj obj;
+  ValueArray items;
+} ObjList;
+
 ObjBoundMethod* newBoundMethod(Value receiver, ObjClosure* method);
 ObjClass* newClass(ObjString* name);
 ObjClosure* newClosure(ObjFunction* function);
 ObjFunction* newFunction();
 ObjInstance* newInstance(ObjClass* klass);
+ObjList* newList();
+/**
+ * @brief 在列表末尾追加一个元素，可能分配内存，list 和 value 都必须能被 GC 找到
+ */
+void listAppend(ObjList* list, Value value);
 ObjNative* newNative(NativeFn function);
-ObjString* takeString(char* chars, int length);
+ObjShape* newShape();
+/**
+ * @brief 在 shape 中查找字段的下标
+ * 
+ * @return int 字段下标，不存在时返回 -1
+ */
+int shapeFieldIndex(ObjShape* shape, ObjString* name);
+/**
+ * @brief 返回在 shape 基础上添加字段 name 之后的 shape，已有迁移时直接复用
+ */
+ObjShape* shapeAddField(ObjShape* shape, ObjString* name);
+/**
+ * @brief 为实例添加一个新字段并迁移到 shape，shape 必须是当前 shape 添加该字段后的结果
+ * 
+ * @param instance 实例
+ * @param shape 迁移后的 shape，新字段位于最后一个下标
+ * @param value 字段值
+ */
+void instanceAddField(ObjInstance* instance, ObjShape* shape, Value value);
+/**
+ * @brief 
+ * 计算 length 个字符的哈希值，开启 WORD_HASH 时每次处理 8 字节，
+ * 否则逐字节计算 FNV-1a；只读取 [key, key + length) 范围内的字节
+ */
+uint32_t hashString(const char* key, int length);
 ObjString* copyString(const char* chars, int length);
+/**
+ * @brief 
+ * 拼接两个字符串，开启 ROPE_STRING 时较长的结果是 rope，不复制字符；
+ * 拼接的结果都不进入字符串驻留表。a 和 b 必须能被 GC 找到
+ */
+ObjString* concatenateStrings(ObjString* a, ObjString* b);
+/**
+ * @brief 
+ * 返回 string 中从 start 开始的 length 个字符，开启 SLICE_STRING 时较长的结果是切片，不复制字符；
+ * 范围由调用方检查。string 必须能被 GC 找到
+ */
+ObjString* sliceString(ObjString* string, int start, int length);
+/**
+ * @brief 
+ * 返回字符串的哈希值，第一次调用时才计算并保存在 hash 中；
+ * rope 需要先展开，会分配内存，string 必须能被 GC 找到
+ */
+uint32_t stringHash(ObjString* string);
+/**
+ * @brief 
+ * 把 rope 展开成连续的字符，会分配内存，
+ * 调用方要保证 string 能被 GC 找到
+ * 
+ * @return ObjString* 字符连续的字符串，string 不是 rope 时就是它本身
+ */
+ObjString* flattenString(ObjString* string);
+/**
+ * @brief 
+ * 返回内容相同并且进入了字符串驻留表的 STRING_FLAT 字符串，可以作为哈希表的 key，
+ * 也可以当作 C 字符串使用；可能分配内存，string 必须能被 GC 找到
+ */
+ObjString* internString(ObjString* string);
+/**
+ * @brief 按内容比较两个字符串，可能展开 rope，a 和 b 都必须能被 GC 找到
+ */
+bool stringsEqual(ObjString* a, ObjString* b);
 ObjUpvalue* newUpvalue(Value* slot);
 void printObject(Value value);
 
@@ -111,4 +274,17 @@ static inline bool isObjType(Value value, ObjType type) {
   return IS_OBJ(value) && OBJ_TYPE(value) == type;
 }
 
+/**
+ * @brief 
+ * 返回字符串连续的 length 个字符，rope 会先展开，见 flattenString；
+ * 切片直接返回 parent 中的字符，后面没有 '\0'
+ */
+static inline const char* stringChars(ObjString* string) {
+  switch (string->kind) {
+    case STRING_ROPE: return flattenString(string)->chars;
+    case STRING_SLICE: return ((ObjSlice*)string)->parent->chars + ((ObjSlice*)string)->start;
+    default: return string->chars;
+  }
+}
+
 #endif
\ No newline at end of file
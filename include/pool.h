@@ -0,0 +1,211 @@
+#ifndef clox_pool_h
+#define clox_pool_h
+
+#include <stdint.h>
+
+#include "common.h"
+
+// 内存池的页大小，页按照自身大小对齐，通过地址就能找到所在的页
+#define POOL_PAGE_SIZE (64 * 1024)
+// 尺寸类的粒度
+#define POOL_GRANULE 16
+// 交给内存池管理的最大尺寸，更大的内存直接使用 malloc
+#define POOL_MAX_SIZE 256
+#define POOL_CLASS_COUNT (POOL_MAX_SIZE / POOL_GRANULE)
+// 页内每个粒度对应位图中的一位
+#define POOL_BITMAP_WORDS (POOL_PAGE_SIZE / POOL_GRANULE / 64)
+
+/**
+ * @brief
+ * 内存池页的头部，页中剩下的空间切分成同样大小的块；
+ * 对象页用两张位图记录每个块是否是存活的对象以及 GC 标记，
+ * 位下标是块起始地址在页内的粒度序号
+ */
+typedef struct PoolPage {
+  struct PoolPage* next; // 同一种用途的下一页
+  struct PoolPage* classNext; // 同一尺寸类的下一个对象页
+  int sizeClass;
+  bool needsSweep; // 延迟清除时，标记完成后还没有清除过的页
+  uint64_t live[POOL_BITMAP_WORDS];
+  uint64_t marks[POOL_BITMAP_WORDS];
+} PoolPage;
+
+/**
+ * @brief 超过 POOL_MAX_SIZE 的对象直接 malloc，对象前面放这个头部
+ */
+typedef struct LargeObject {
+  struct LargeObject* prev;
+  struct LargeObject* next;
+  size_t size;
+  bool isMarked;
+} LargeObject;
+
+/**
+ * @brief 一个尺寸类中暂存的空闲块链表
+ */
+typedef struct {
+  void* head;
+  void* tail;
+} PoolFreeList;
+
+/**
+ * @brief
+ * 并行清除时每个线程先把释放的块暂存在自己的缓存中，
+ * 不去修改全局的空闲链表，清除结束后再统一并入内存池
+ */
+typedef struct {
+  PoolFreeList raw[POOL_CLASS_COUNT];
+  PoolFreeList objects[POOL_CLASS_COUNT];
+} PoolFreeCache;
+
+/**
+ * @brief 对象所在的页
+ */
+static inline PoolPage* poolPageOf(void* pointer) {
+  return (PoolPage*)((uintptr_t)pointer & ~(uintptr_t)(POOL_PAGE_SIZE - 1));
+}
+
+/**
+ * @brief 对象在页内位图中的位下标
+ */
+static inline int poolBitOf(PoolPage* page, void* pointer) {
+  return (int)(((char*)pointer - (char*)page) / POOL_GRANULE);
+}
+
+/**
+ * @brief 位图中的位下标对应的块地址
+ */
+static inline void* poolBlockAt(PoolPage* page, int bit) {
+  return (char*)page + (size_t)bit * POOL_GRANULE;
+}
+
+static inline LargeObject* poolLargeOf(void* pointer) {
+  return (LargeObject*)pointer - 1;
+}
+
+// 并发标记时后台线程和 VM 线程会同时读写同一个位图字，需要原子操作
+static inline bool poolIsMarked(void* pointer) {
+  PoolPage* page = poolPageOf(pointer);
+  int bit = poolBitOf(page, pointer);
+#ifdef GC_CONCURRENT
+  uint64_t word = __atomic_load_n(&page->marks[bit / 64], __ATOMIC_RELAXED);
+#else
+  uint64_t word = page->marks[bit / 64];
+#endif
+  return (word >> (bit % 64)) & 1;
+}
+
+static inline void poolSetMarked(void* pointer) {
+  PoolPage* page = poolPageOf(pointer);
+  int bit = poolBitOf(page, pointer);
+#ifdef GC_CONCURRENT
+  __atomic_fetch_or(&page->marks[bit / 64], (uint64_t)1 << (bit % 64), __ATOMIC_RELAXED);
+#else
+  page->marks[bit / 64] |= (uint64_t)1 << (bit % 64);
+#endif
+}
+
+/**
+ * @brief
+ * 按尺寸类分配的小块内存，尺寸向上取整到 POOL_GRANULE 的倍数；
+ * 超过 POOL_MAX_SIZE 的请求直接交给 malloc
+ *
+ * @param size 需要的内存大小，不能为 0
+ * @return void*
+ */
+void* poolAllocate(size_t size);
+
+/**
+ * @brief
+ * 释放 poolAllocate 分配的内存，小块内存放回对应尺寸类的空闲链表
+ *
+ * @param pointer 需要释放的指针
+ * @param size 分配时的大小，必须和分配时一致
+ */
+void poolFree(void* pointer, size_t size);
+
+/**
+ * @brief
+ * 调整 poolAllocate 分配的内存大小，新旧大小属于同一个尺寸类时原地返回
+ *
+ * @param pointer 原指针，不能为 NULL
+ * @param oldSize 原大小
+ * @param newSize 新大小，不能为 0
+ * @return void*
+ */
+void* poolReallocate(void* pointer, size_t oldSize, size_t newSize);
+
+/**
+ * @brief
+ * 分配 GC 管理的对象：小对象放在单独的对象页中并在位图中登记，
+ * 大对象带上 LargeObject 头部并加入大对象链表；
+ * 新对象都没有标记，分配在等待延迟清除的页中时除外
+ *
+ * @param size 对象大小
+ * @return void*
+ */
+void* poolAllocateObject(size_t size);
+
+/**
+ * @brief 释放 poolAllocateObject 分配的对象
+ *
+ * @param pointer
+ * @param size 分配时的大小
+ */
+void poolFreeObject(void* pointer, size_t size);
+
+/**
+ * @brief 所有对象页组成的链表，新页插在表头
+ */
+PoolPage* poolObjectPages();
+
+/**
+ * @brief 所有大对象组成的链表，新对象插在表头
+ */
+LargeObject* poolLargeObjects();
+
+/**
+ * @brief 清除所有对象的标记
+ */
+void poolClearMarks();
+
+/**
+ * @brief 
+ * 开始延迟清除：所有对象页都标记为等待清除，
+ * 之后分配到这些页中的对象直接带上标记，不会被之后的清除释放
+ *
+ * @return int 等待清除的页数
+ */
+int poolBeginLazySweep();
+
+/**
+ * @brief 
+ * size 对应的尺寸类已经没有空闲块时，返回它下一个等待清除的页，
+ * 否则返回 NULL；返回的页不再处于等待清除状态
+ * 
+ * @param size 对象大小
+ */
+PoolPage* poolNextUnsweptPage(size_t size);
+
+/**
+ * @brief 
+ * 当前线程之后释放的小块都放入 cache，传 NULL 恢复直接放回内存池；
+ * 释放大块内存和大对象不受影响
+ * 
+ * @param cache 
+ */
+void poolUseFreeCache(PoolFreeCache* cache);
+
+/**
+ * @brief 把 cache 中暂存的块并入内存池的空闲链表并清空 cache，调用者负责互斥
+ * 
+ * @param cache 
+ */
+void poolMergeFreeCache(PoolFreeCache* cache);
+
+/**
+ * @brief 将内存池所有的页归还给系统
+ */
+void freePool();
+
+#endif
@@ -9,10 +9,41 @@ typedef struct {
   Value value;
 } Entry;
 
+#ifdef SMALL_TABLE
+// 小表最多内联保存的条目数：Table 不超过 120 字节，
+// 带两个 Table 的 ObjShape 仍然能从内存池的尺寸类中分配
+#define TABLE_SMALL_CAPACITY ((int)(104 / (sizeof(ObjString*) + sizeof(Value))))
+#endif
+
+/**
+ * @brief 
+ * 开放寻址的哈希表，删除的条目留下墓碑，count 包括墓碑；
+ * 没有使用的槽位和墓碑的 key 都是 NULL。
+ * 插入时负载主要来自墓碑就原地重新散列，删除之后存活条目太少时缩小容量。
+ * 开启 SMALL_TABLE 时 capacity 为 0 表示小表：count 个条目直接保存在内联数组中，
+ * 按指针逐个比较 key，超过 TABLE_SMALL_CAPACITY 个条目时才切换到哈希表
+ */
 typedef struct {
   int count;
+  int tombstones; // count 中墓碑的数量
   int capacity;
-  Entry* entries;
+  union {
+    struct {
+      Entry* entries;
+#ifdef SWISS_TABLE
+      // 每个槽位一个控制字节：空槽位、墓碑或者 key 哈希值的低 7 位，
+      // 和 entries 在同一块内存中，紧跟在 entries 之后
+      uint8_t* control;
+#endif
+    };
+#ifdef SMALL_TABLE
+    // 小表的 key 和 value，和哈希表的指针共用内存
+    struct {
+      ObjString* smallKeys[TABLE_SMALL_CAPACITY];
+      Value smallValues[TABLE_SMALL_CAPACITY];
+    };
+#endif
+  };
 } Table;
 
 void initTable(Table* table);
@@ -45,7 +76,7 @@ bool tableGet(Table* table, ObjString* key, Value* value);
 bool tableSet(Table* table, ObjString* key, Value value);
 
 /**
- * @brief 用于删除 Table 中的指定条目
+ * @brief 用于删除 Table 中的指定条目，可能缩小容量或者重新散列
  * 
  * @param  table HashTable指针
  * @param  key   需要删除的 Key 的指针
@@ -73,7 +104,7 @@ void tableAddAll(Table* from, Table* to);
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
 
 /**
- * @brief 清理 string set 中的弱引用条目
+ * @brief 清理 string set 中的弱引用条目，清理之后和 tableDelete 一样整理哈希表
  * 
  * @param table 
  */
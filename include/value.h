@@ -16,15 +16,25 @@ typedef struct ObjString ObjString;
 #define TAG_NIL   1 // 01.
 #define TAG_FALSE 2 // 10.
 #define TAG_TRUE  3 // 11.
+// 小整数：QNAN 之外再设置第 48 位，低 32 位保存 int32_t
+#define TAG_INT   ((uint64_t)1 << 48)
 
 typedef uint64_t Value;
 
 #define IS_BOOL(value)      (((value) | 1) == TRUE_VAL)
 #define IS_NIL(value)       ((value) == NIL_VAL)
-#define IS_NUMBER(value)    (((value) & QNAN) != QNAN)
+#define IS_DOUBLE(value)    (((value) & QNAN) != QNAN)
 #define IS_OBJ(value)       (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#ifdef SMALL_INT
+#define IS_INT(value)       (((value) & (SIGN_BIT | QNAN | TAG_INT)) == (QNAN | TAG_INT))
+#define IS_NUMBER(value)    (IS_DOUBLE(value) || IS_INT(value))
+#else
+#define IS_INT(value)       false
+#define IS_NUMBER(value)    IS_DOUBLE(value)
+#endif
 
 #define AS_BOOL(value)      ((value) == TRUE_VAL)
+#define AS_INT(value)       ((int32_t)(uint32_t)(value))
 #define AS_NUMBER(value)    valueToNum(value)
 #define AS_OBJ(value)       ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
 
@@ -33,11 +43,16 @@ typedef uint64_t Value;
 #define TRUE_VAL        ((Value)(uint64_t)(QNAN | TAG_TRUE))
 #define NIL_VAL         ((Value)(uint64_t)(QNAN | TAG_NIL))
 
+#define INT_VAL(i)      ((Value)(QNAN | TAG_INT | (uint32_t)(int32_t)(i)))
 #define NUMBER_VAL(num) numToValue(num)
 #define OBJ_VAL(obj) \
     (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
 
+/**
+ * @brief 取出数字的值，小整数转换成 double
+ */
 static inline double valueToNum(Value value) {
+  if (IS_INT(value)) return (double)AS_INT(value);
   double num;
   memcpy(&num, &value, sizeof(Value));
   return num;
@@ -55,6 +70,7 @@ typedef enum {
   VAL_BOOL,
   VAL_NIL,
   VAL_NUMBER,
+  VAL_INT, // 小整数，和 VAL_NUMBER 一样是 Lox 的数字
   VAL_OBJ
 } ValueType;
 
@@ -63,26 +79,57 @@ typedef struct {
   union {
     bool boolean;
     double number;
+    int32_t integer;
     Obj* obj;
   } as; 
 } Value;
 
 #define IS_BOOL(value)    ((value).type == VAL_BOOL)
 #define IS_NIL(value)     ((value).type == VAL_NIL)
-#define IS_NUMBER(value)  ((value).type == VAL_NUMBER)
+#define IS_DOUBLE(value)  ((value).type == VAL_NUMBER)
 #define IS_OBJ(value)     ((value).type == VAL_OBJ)
+#ifdef SMALL_INT
+#define IS_INT(value)     ((value).type == VAL_INT)
+#define IS_NUMBER(value)  (IS_DOUBLE(value) || IS_INT(value))
+#else
+#define IS_INT(value)     false
+#define IS_NUMBER(value)  IS_DOUBLE(value)
+#endif
 
 #define AS_OBJ(value)     ((value).as.obj)
 #define AS_BOOL(value)    ((value).as.boolean)
-#define AS_NUMBER(value)  ((value).as.number)
+#define AS_INT(value)     ((value).as.integer)
+#define AS_NUMBER(value)  valueToNum(value)
 
 #define BOOL_VAL(value)   ((Value){VAL_BOOL, {.boolean = value}})
 #define NIL_VAL           ((Value){VAL_NIL, {.number = 0}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
+#define INT_VAL(value)    ((Value){VAL_INT, {.integer = value}})
 #define OBJ_VAL(object)   ((Value){VAL_OBJ, {.obj = (Obj*)object}})
 
+/**
+ * @brief 取出数字的值，小整数转换成 double
+ */
+static inline double valueToNum(Value value) {
+  if (IS_INT(value)) return (double)AS_INT(value);
+  return value.as.number;
+}
+
 #endif 
 
+/**
+ * @brief 
+ * 整数运算的结果：在 int32_t 范围内时仍然是小整数，否则提升为 double；
+ * 调用方用 int64_t 计算两个 int32_t 的加减乘，不会溢出
+ * 
+ * @param value 
+ * @return Value 
+ */
+static inline Value intValue(int64_t value) {
+  if (value >= INT32_MIN && value <= INT32_MAX) return INT_VAL((int32_t)value);
+  return NUMBER_VAL((double)value);
+}
+
 typedef struct {
   int count;
   int capacity;
@@ -2,6 +2,7 @@
 #define clox_vm_h
 
 #include "object.h"
+#include "pool.h"
 #include "table.h"
 #include "value.h"
 
@@ -18,6 +19,66 @@ typedef struct {
   Value* slots; // 指向闭包内第一个局部变量槽位
 } CallFrame;
 
+/**
+ * @brief 全局变量槽位，编译期按变量名分配固定下标
+ */
+typedef struct {
+  ObjString* name; // 变量名，用于报错
+  Value value;
+  bool defined; // 是否已经执行过 var / fun / class 声明
+} Global;
+
+/**
+ * @brief 增量回收的阶段
+ */
+typedef enum {
+  GC_PHASE_IDLE,
+  GC_PHASE_MARK,
+  GC_PHASE_SWEEP,
+} GCPhase;
+
+/**
+ * @brief 
+ * GC 的节奏设置，大小的单位都是字节，0 表示不限制：
+ * 回收之后的阈值按存活内存乘以 growFactor 计算，再限制在 [minHeap, maxHeap] 之间；
+ * heapLimit 是硬上限，完整回收之后仍然超过就报运行时错误
+ */
+typedef struct {
+  size_t initialHeap; // 第一次回收的阈值
+  double growFactor; // 堆增长系数，必须大于 1
+  size_t minHeap; // 回收阈值的下限
+  size_t maxHeap; // 回收阈值的上限，存活内存本身超过它时只保留很小的余量
+  size_t heapLimit; // 堆的硬上限
+} GCConfig;
+
+// GC 停顿直方图的桶数：第 i 个桶统计 [2^i, 2^(i+1)) 微秒的停顿，
+// 第 0 个桶也包括不到 1 微秒的停顿，最后一个桶包括所有更长的停顿
+#define GC_PAUSE_BUCKETS 20
+
+/**
+ * @brief 
+ * GC 统计数据，总是开启，只在分配、释放和回收时累加计数；
+ * 时间的单位是纳秒。读取时使用 readGCStats 取得一致的快照
+ */
+typedef struct {
+  int youngCollections; // 新生代回收的次数
+  int fullCollections; // 完整回收的次数，增量和并发回收时是开始的轮数
+  int pauseCount;
+  uint64_t pauseTotal;
+  uint64_t pauseWorst;
+  int pauseHistogram[GC_PAUSE_BUCKETS];
+  // 标记和清除各自花费的时间，延迟清除的时间也计入清除
+  uint64_t markTime;
+  uint64_t sweepTime;
+  // 后台线程上并发标记花费的时间
+  uint64_t concurrentMarkTime;
+  // 累计分配和释放的内存，两者之差就是 vm.bytesAllocated
+  uint64_t totalAllocated;
+  uint64_t totalFreed;
+  // 每种类型已经分配、还没有被清除的对象数
+  int liveObjects[OBJ_TYPE_COUNT];
+} GCStats;
+
 /**
  * @brief VM 结构体
  */
@@ -27,14 +88,47 @@ typedef struct {
 
   Value stack[STACK_MAX]; // 表达式求值时临时存储在栈内，初始化长度 256
   Value* stackTop; // 当前的栈顶位置
-  Table globals; // 常量集合
+  Table globalNames; // 全局变量名 -> globals 数组下标
+  Global* globals; // 全局变量数组，运行时按下标直接访问
+  int globalCount;
+  int globalCapacity;
   Table strings; // string intern
   ObjString* initString;
   ObjUpvalue* openUpvalues; // 所有 upvalue 集合，保证复用
   
   size_t bytesAllocated;
   size_t nextGC;
-  Obj* objects;
+  size_t nextFullGC; // 超过后下一次回收做完整回收
+  GCConfig gcConfig;
+  // 上一次完整回收之后存活的内存，延迟清除释放的内存也会从中扣除
+  size_t gcLiveBytes;
+  // 超过了堆的硬上限，等待在下一个安全点报错
+  bool heapExhausted;
+  // 新生代对象：上一次回收之后分配的所有对象
+  int youngCount;
+  int youngCapacity;
+  Obj** youngObjects;
+  // 记忆集：可能引用了新生代对象的老年代对象
+  int rememberedCount;
+  int rememberedCapacity;
+  Obj** rememberedSet;
+  // 增量回收的当前阶段
+  GCPhase gcPhase;
+  // 并发标记：等待在安全点开始的回收请求，以及提出请求时已经分配的内存
+  bool gcRequested;
+  size_t gcRequestBytes;
+  // 并发标记的轮次，用来判断对象在本轮是否已经扫描过
+  uint8_t gcEpoch;
+  // 增量清除的位置：下一个待清除的对象页和大对象
+  PoolPage* sweepPage;
+  LargeObject* sweepLarge;
+  // 每个增量回收片段的停顿预算，单位纳秒
+  uint64_t gcSliceBudget;
+  GCStats gcStats;
+  // 延迟清除时还没有清除的对象页数
+  int unsweptPages;
+  // 完整回收时并行清除对象页的线程数，包括 VM 线程自己
+  int gcSweepWorkers;
   // 用于存储 GC 对象的灰色栈
   int grayCount;
   int grayCapacity;
@@ -54,6 +148,18 @@ extern VM vm;
 
 void initVM();
 void freeVM();
+/**
+ * @brief 把 config 设置为默认的 GC 节奏
+ * 
+ * @param config 
+ */
+void initGCConfig(GCConfig* config);
+/**
+ * @brief 在 initVM 之后调用，替换 GC 节奏设置并按 initialHeap 重新设置下一次回收的阈值
+ * 
+ * @param config 
+ */
+void configureGC(const GCConfig* config);
 /**
  * @brief 解释器执行入口，输入源代码，输出执行完成时状态
  * 
@@ -61,6 +167,13 @@ void freeVM();
  * @return InterpretResult 
  */
 InterpretResult interpret(const char* source);
+/**
+ * @brief 返回全局变量名对应的槽位下标，第一次出现的变量名会分配一个未定义的新槽位
+ * 
+ * @param name 变量名
+ * @return int globals 数组下标
+ */
+int resolveGlobal(ObjString* name);
 void push(Value value);
 Value pop();
 
@@ -40,7 +40,7 @@ typedef enum {
   PREC_TERM,        // + -
   PREC_FACTOR,      // * /
   PREC_UNARY,       // ! -
-  PREC_CALL,        // . ()
+  PREC_CALL,        // . () []
   PREC_PRIMARY
 } Precedence;
 
@@ -256,6 +256,7 @@ static void emitReturn() {
  */
 static uint8_t makeConstant(Value value) {
   int constant = addConstant(currentChunk(), value);
+  writeBarrier((Obj*)current->function, value);
   if (constant > UINT8_MAX) {
     error("Too many constants in one chunk.");
     return 0;
@@ -271,6 +272,19 @@ static void emitConstant(Value value) {
   emitBytes(OP_CONSTANT, makeConstant(value));
 }
 
+/**
+ * @brief 为当前调用点分配一个内联缓存，并输出 2 字节的缓存下标
+ */
+static void emitInlineCache() {
+  int cache = addInlineCache(currentChunk());
+  if (cache > UINT16_MAX) {
+    error("Too many property accesses in one chunk.");
+  }
+
+  emitByte((cache >> 8) & 0xff);
+  emitByte(cache & 0xff);
+}
+
 /**
  * 根据当前的字节码位置和 offset 计算需要跳转的距离，
  * 并补全 offset 位置 emitJump 的字节码
@@ -305,6 +319,7 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
   current = compiler;
   if (type != TYPE_SCRIPT) {
     current->function->name = copyString(parser.previous.start, parser.previous.length);
+    writeBarrier((Obj*)current->function, OBJ_VAL(current->function->name));
   }
   
   Local* local = &current->locals[current->localCount++];
@@ -387,6 +402,38 @@ static uint8_t identifierConstant(Token* name) {
   return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
 }
 
+/**
+ * 将变量名映射为全局变量槽位下标，运行时按下标直接访问全局变量
+ * 
+ * @param name 变量名 Token
+ * 
+ * @return 全局变量槽位下标
+ */
+static uint16_t globalSlot(Token* name) {
+  int slot = resolveGlobal(copyString(name->start, name->length));
+  if (slot > UINT16_MAX) {
+    error("Too many global variables.");
+    return 0;
+  }
+
+  return (uint16_t)slot;
+}
+
+/**
+ * 输出读写变量的指令，全局变量的槽位下标占 2 字节，其余变量占 1 字节
+ * 
+ * @param op 指令
+ * @param arg 局部变量 / upvalue / 全局变量的下标
+ */
+static void emitVariable(uint8_t op, int arg) {
+  if (op == OP_GET_GLOBAL || op == OP_SET_GLOBAL || op == OP_DEFINE_GLOBAL) {
+    emitBytes(op, (arg >> 8) & 0xff);
+    emitByte(arg & 0xff);
+  } else {
+    emitBytes(op, (uint8_t)arg);
+  }
+}
+
 /**
  * 对比变量名是否相同 
  */
@@ -514,16 +561,16 @@ static void declareVariable() {
  * @brief 解析变量名，如果是局部变量，则同时添加到编译器缓存内
  * 
  * @param errorMessage 没有解析到 TOKEN_IDENTIFIER 时输出的异常信息
- * @return 返回变量名的常量索引
+ * @return 返回全局变量的槽位下标
  */
-static uint8_t parseVariable(const char* errorMessage) {
+static uint16_t parseVariable(const char* errorMessage) {
   consume(TOKEN_IDENTIFIER, errorMessage);
 
   declareVariable();
-  // 如果是局部变量，不需要返回变量名的常量索引，所以返回 0
+  // 如果是局部变量，不需要全局变量槽位，所以返回 0
   if (current->scopeDepth > 0) return 0;
 
-  return identifierConstant(&parser.previous);
+  return globalSlot(&parser.previous);
 }
 
 /**
@@ -540,15 +587,15 @@ static void markInitialized() {
  * 局部变量：标记为已初始化完成
  * 全局变量：添加一个 OP_DEFINE_GLOBAL global 到字节码中
  * 
- * @param global 全局变量名的常量索引
+ * @param global 全局变量的槽位下标
  */
-static void defineVariable(uint8_t global) {
+static void defineVariable(uint16_t global) {
   if (current->scopeDepth > 0) {
     markInitialized();
     return;
   }
 
-  emitBytes(OP_DEFINE_GLOBAL, global);
+  emitVariable(OP_DEFINE_GLOBAL, global);
 }
 
 static uint8_t argumentList() {
@@ -608,6 +655,21 @@ static void call(bool canAssign) {
   emitBytes(OP_CALL, argCount);
 }
 
+/**
+ * @brief 编译下标访问 `list[index]` 和下标赋值 `list[index] = value`
+ */
+static void index_(bool canAssign) {
+  expression();
+  consume(TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+
+  if (canAssign && match(TOKEN_EQUAL)) {
+    expression();
+    emitByte(OP_INDEX_SET);
+  } else {
+    emitByte(OP_INDEX_GET);
+  }
+}
+
 static void dot(bool canAssign) {
   consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
   uint8_t name = identifierConstant(&parser.previous);
@@ -615,12 +677,15 @@ static void dot(bool canAssign) {
   if (canAssign && match(TOKEN_EQUAL)) {
     expression();
     emitBytes(OP_SET_PROPERTY, name);
+    emitInlineCache();
   } else if (match(TOKEN_LEFT_PAREN)) {
     uint8_t argCount = argumentList();
     emitBytes(OP_INVOKE, name);
     emitByte(argCount);
+    emitInlineCache();
   } else {
     emitBytes(OP_GET_PROPERTY, name);
+    emitInlineCache();
   }
 }
 
@@ -636,6 +701,24 @@ static void literal(bool canAssign) {
   }
 }
 
+/**
+ * @brief 编译列表字面量 `[a, b, c]`，元素依次压栈之后由 OP_BUILD_LIST 一次取出
+ */
+static void list(bool canAssign) {
+  uint8_t count = 0;
+  if (!check(TOKEN_RIGHT_BRACKET)) {
+    do {
+      expression();
+      if (count == 255) {
+        error("Can't have more than 255 elements in a list literal.");
+      }
+      count++;
+    } while (match(TOKEN_COMMA));
+  }
+  consume(TOKEN_RIGHT_BRACKET, "Expect ']' after list elements.");
+  emitBytes(OP_BUILD_LIST, count);
+}
+
 /**
  * @brief 处理括号内的表达式
  */
@@ -646,6 +729,13 @@ static void grouping(bool canAssign) {
 
 static void number(bool canAssign) {
   double value = strtod(parser.previous.start, NULL);
+#ifdef SMALL_INT
+  // 能用 int32_t 表示的字面量编译成小整数，1.0 这样的写法也一样
+  if (value >= INT32_MIN && value <= INT32_MAX && value == (int32_t)value) {
+    emitConstant(INT_VAL((int32_t)value));
+    return;
+  }
+#endif
   emitConstant(NUMBER_VAL(value));
 }
 
@@ -685,16 +775,16 @@ static void namedVariable(Token name, bool canAssign) {
     getOp = OP_GET_UPVALUE;
     setOp = OP_SET_UPVALUE;
   } else {
-    arg = identifierConstant(&name);
+    arg = globalSlot(&name);
     getOp = OP_GET_GLOBAL;
     setOp = OP_SET_GLOBAL;
   }
   
   if (canAssign && match(TOKEN_EQUAL)) {
     expression();
-    emitBytes(setOp, (uint8_t)arg);
+    emitVariable(setOp, arg);
   } else {
-    emitBytes(getOp, (uint8_t)arg);
+    emitVariable(getOp, arg);
   }
 }
 
@@ -763,6 +853,8 @@ ParseRule rules[] = {
   [TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   PREC_NONE},
   [TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE}, 
   [TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   PREC_NONE},
+  [TOKEN_LEFT_BRACKET]  = {list,     index_, PREC_CALL},
+  [TOKEN_RIGHT_BRACKET] = {NULL,     NULL,   PREC_NONE},
   [TOKEN_COMMA]         = {NULL,     NULL,   PREC_NONE},
   [TOKEN_DOT]           = {NULL,     dot,    PREC_CALL},
   [TOKEN_MINUS]         = {unary,    binary, PREC_TERM},
@@ -870,7 +962,7 @@ static void function(FunctionType type) {
       if (current->function->arity > 255) {
         errorAtCurrent("Can't have more than 255 parameters.");
       }
-      uint8_t constant = parseVariable("Expect parameter name.");
+      uint16_t constant = parseVariable("Expect parameter name.");
       defineVariable(constant);
     } while (match(TOKEN_COMMA));
   }
@@ -907,7 +999,7 @@ static void classDeclaration() {
   declareVariable();
 
   emitBytes(OP_CLASS, nameConstant);
-  defineVariable(nameConstant);
+  defineVariable(current->scopeDepth > 0 ? 0 : globalSlot(&className));
 
   ClassCompiler classCompiler;
   classCompiler.hasSuperclass = false;
@@ -947,14 +1039,14 @@ static void classDeclaration() {
 }
 
 static void funDeclaration() {
-  uint8_t global = parseVariable("Expect function name.");
+  uint16_t global = parseVariable("Expect function name.");
   markInitialized();
   function(TYPE_FUNCTION);
   defineVariable(global);
 }
 
 static void varDeclaration() {
-  uint8_t global = parseVariable("Expect variable name.");
+  uint16_t global = parseVariable("Expect variable name.");
 
   if (match(TOKEN_EQUAL)) {
     expression();
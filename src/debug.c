@@ -1,8 +1,10 @@
 #include <stdio.h>
 
 #include "debug.h"
+#include "memory.h"
 #include "value.h"
 #include "object.h"
+#include "vm.h"
 
 void disassembleChunk(Chunk* chunk, const char* name) {
   printf("== %s ==\n", name);
@@ -37,6 +39,44 @@ static int invokeInstruction(const char* name, Chunk* chunk, int offset) {
   return offset + 3;
 }
 
+/**
+ * @brief 带内联缓存的指令，输出指令名称、常量值和缓存下标
+ * 
+ * @param name 指令名称
+ * @param chunk 字节码
+ * @param offset 当前指令位置
+ * @param operands 缓存下标之前的操作数长度
+ * @return int 移动 offset 到下一个指令位置
+ */
+static int cachedInstruction(const char* name, Chunk* chunk, int offset, int operands) {
+  uint8_t constant = chunk->code[offset + 1];
+  uint16_t cache = (uint16_t)(chunk->code[offset + operands + 1] << 8);
+  cache |= chunk->code[offset + operands + 2];
+  if (operands == 2) {
+    printf("%-16s (%d args) %4d '", name, chunk->code[offset + 2], constant);
+  } else {
+    printf("%-16s %4d '", name, constant);
+  }
+  printValue(chunk->constants.values[constant]);
+  printf("' ic %d\n", cache);
+  return offset + operands + 3;
+}
+
+/**
+ * @brief 全局变量指令，输出指令名称、2 字节的槽位下标和变量名
+ * 
+ * @param name 指令名称
+ * @param chunk 字节码
+ * @param offset 当前指令位置
+ * @return int 移动 offset 到下一个指令位置
+ */
+static int globalInstruction(const char* name, Chunk* chunk, int offset) {
+  uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8);
+  slot |= chunk->code[offset + 2];
+  printf("%-16s %4d '%s'\n", name, slot, vm.globals[slot].name->chars);
+  return offset + 3;
+}
+
 /**
  * @brief 最简单的指令，没有参数，直接输出指令名称
  * 
@@ -103,21 +143,27 @@ int disassembleInstruction(Chunk* chunk, int offset) {
   case OP_SET_LOCAL:
     return byteInstruction("OP_SET_LOCAL", chunk, offset);
   case OP_GET_GLOBAL:
-    return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+    return globalInstruction("OP_GET_GLOBAL", chunk, offset);
   case OP_SET_GLOBAL:
-    return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+    return globalInstruction("OP_SET_GLOBAL", chunk, offset);
   case OP_DEFINE_GLOBAL:
-    return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+    return globalInstruction("OP_DEFINE_GLOBAL", chunk, offset);
   case OP_GET_UPVALUE:
     return byteInstruction("OP_GET_UPVALUE", chunk, offset);
   case OP_SET_UPVALUE:
     return byteInstruction("OP_SET_UPVALUE", chunk, offset);
   case OP_GET_PROPERTY:
-    return constantInstruction("OP_GET_PROPERTY", chunk, offset);
+    return cachedInstruction("OP_GET_PROPERTY", chunk, offset, 1);
   case OP_SET_PROPERTY:
-    return constantInstruction("OP_SET_PROPERTY", chunk, offset);
+    return cachedInstruction("OP_SET_PROPERTY", chunk, offset, 1);
   case OP_GET_SUPER:
     return constantInstruction("OP_GET_SUPER", chunk, offset);
+  case OP_BUILD_LIST:
+    return byteInstruction("OP_BUILD_LIST", chunk, offset);
+  case OP_INDEX_GET:
+    return simpleInstruction("OP_INDEX_GET", offset);
+  case OP_INDEX_SET:
+    return simpleInstruction("OP_INDEX_SET", offset);
   case OP_POP:
     return simpleInstruction("OP_POP", offset);
   case OP_GREATER:
@@ -147,7 +193,7 @@ int disassembleInstruction(Chunk* chunk, int offset) {
   case OP_CALL:
     return byteInstruction("OP_CALL", chunk, offset);
   case OP_INVOKE:
-    return invokeInstruction("OP_INVOKE", chunk, offset);
+    return cachedInstruction("OP_INVOKE", chunk, offset, 2);
   case OP_SUPER_INVOKE:
     return invokeInstruction("OP_SUPER_INVOKE", chunk, offset);
   case OP_CLOSURE: {
@@ -182,3 +228,99 @@ int disassembleInstruction(Chunk* chunk, int offset) {
     return offset + 1;
   }
 }
+
+void printInlineCacheStats() {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+
+  printf("== inline caches ==\n");
+  HeapIterator iterator;
+  initHeapIterator(&iterator);
+  Obj* object;
+  while ((object = nextHeapObject(&iterator)) != NULL) {
+    if (object->type != OBJ_FUNCTION) continue;
+
+    ObjFunction* function = (ObjFunction*)object;
+    for (int i = 0; i < function->chunk.cacheCount; i++) {
+      InlineCache* cache = &function->chunk.caches[i];
+      uint64_t total = cache->hits + cache->misses;
+      if (total == 0) continue;
+
+      printf("%-16s ic %4d %3d entries %10llu hits %10llu misses %6.2f%%\n",
+             function->name != NULL ? function->name->chars : "<script>",
+             i, cache->count,
+             (unsigned long long)cache->hits,
+             (unsigned long long)cache->misses,
+             100.0 * cache->hits / total);
+      hits += cache->hits;
+      misses += cache->misses;
+    }
+  }
+
+  if (hits + misses > 0) {
+    printf("total %llu hits %llu misses %.2f%%\n",
+           (unsigned long long)hits, (unsigned long long)misses,
+           100.0 * hits / (hits + misses));
+  }
+}
+
+void printGCPauseStats() {
+  GCStats* stats = &vm.gcStats;
+  // 输出到 stderr，不和脚本自身的输出混在一起
+  fprintf(stderr, "== gc pauses ==\n");
+  fprintf(stderr, "count %d total %.3f ms worst %.3f ms average %.3f ms\n",
+          stats->pauseCount, stats->pauseTotal / 1e6, stats->pauseWorst / 1e6,
+          stats->pauseCount > 0 ? stats->pauseTotal / 1e6 / stats->pauseCount : 0.0);
+  fprintf(stderr, "mark %.3f ms sweep %.3f ms\n",
+          stats->markTime / 1e6, stats->sweepTime / 1e6);
+#ifdef GC_CONCURRENT
+  fprintf(stderr, "concurrent mark %.3f ms\n", stats->concurrentMarkTime / 1e6);
+#endif
+}
+
+const char* objTypeName(ObjType type) {
+  switch (type) {
+    case OBJ_BOUND_METHOD: return "boundMethods";
+    case OBJ_CLASS: return "classes";
+    case OBJ_CLOSURE: return "closures";
+    case OBJ_FUNCTION: return "functions";
+    case OBJ_INSTANCE: return "instances";
+    case OBJ_LIST: return "lists";
+    case OBJ_NATIVE: return "natives";
+    case OBJ_SHAPE: return "shapes";
+    case OBJ_STRING: return "strings";
+    case OBJ_UPVALUE: return "upvalues";
+  }
+  return "unknown";
+}
+
+void writeGCStatsJSON(FILE* file, const GCStats* stats) {
+  fprintf(file, "{\n");
+  fprintf(file, "  \"youngCollections\": %d,\n", stats->youngCollections);
+  fprintf(file, "  \"fullCollections\": %d,\n", stats->fullCollections);
+  fprintf(file, "  \"pauses\": {\n");
+  fprintf(file, "    \"count\": %d,\n", stats->pauseCount);
+  fprintf(file, "    \"totalNs\": %llu,\n", (unsigned long long)stats->pauseTotal);
+  fprintf(file, "    \"worstNs\": %llu,\n", (unsigned long long)stats->pauseWorst);
+  // 第 i 个桶的上界是 2^(i+1) 微秒，最后一个桶没有上界
+  fprintf(file, "    \"histogramUs\": [");
+  for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+    fprintf(file, "%s%d", i > 0 ? ", " : "", stats->pauseHistogram[i]);
+  }
+  fprintf(file, "]\n");
+  fprintf(file, "  },\n");
+  fprintf(file, "  \"markNs\": %llu,\n", (unsigned long long)stats->markTime);
+  fprintf(file, "  \"sweepNs\": %llu,\n", (unsigned long long)stats->sweepTime);
+  fprintf(file, "  \"concurrentMarkNs\": %llu,\n",
+          (unsigned long long)stats->concurrentMarkTime);
+  fprintf(file, "  \"bytesAllocated\": %llu,\n",
+          (unsigned long long)stats->totalAllocated);
+  fprintf(file, "  \"bytesFreed\": %llu,\n", (unsigned long long)stats->totalFreed);
+  fprintf(file, "  \"liveObjects\": {");
+  for (int type = 0; type < OBJ_TYPE_COUNT; type++) {
+    fprintf(file, "%s\n    \"%s\": %d", type > 0 ? "," : "",
+            objTypeName((ObjType)type), stats->liveObjects[type]);
+  }
+  fprintf(file, "\n  }\n");
+  fprintf(file, "}\n");
+}
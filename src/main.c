@@ -1,3 +1,5 @@
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,6 +7,7 @@
 #include "common.h"
 #include "chunk.h"
 #include "debug.h"
+#include "memory.h"
 #include "vm.h"
 
 static void repl() {
@@ -51,30 +54,136 @@ static char* readFile(const char* path) {
   return buffer;
 }
 
-static void runFile(const char* path) {
+/**
+ * @brief 执行脚本文件，返回进程的退出码
+ */
+static int runFile(const char* path) {
   char* source = readFile(path);
   InterpretResult result = interpret(source);
   free(source); 
 
-  if (result == INTERPRET_COMPILE_ERROR) exit(65);
-  if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+  if (result == INTERPRET_COMPILE_ERROR) return 65;
+  if (result == INTERPRET_RUNTIME_ERROR) return 70;
+  return 0;
+}
+
+/**
+ * @brief 把 GC 统计数据以 JSON 格式写入 path，path 为 "-" 时写到 stderr
+ */
+static void dumpGCStats(const char* path) {
+  GCStats stats;
+  readGCStats(&stats);
+
+  FILE* file = strcmp(path, "-") == 0 ? stderr : fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Could not write GC stats to \"%s\".\n", path);
+    return;
+  }
+  writeGCStatsJSON(file, &stats);
+  if (file != stderr) fclose(file);
+}
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: clox [options] [path]\n"
+          "  --gc-initial=SIZE  heap size of the first collection\n"
+          "  --gc-grow=FACTOR   heap growth factor after a collection, > 1\n"
+          "  --gc-min=SIZE      lower bound of the collection threshold\n"
+          "  --gc-max=SIZE      upper bound of the collection threshold\n"
+          "  --gc-limit=SIZE    hard heap limit, exceeding it is a runtime error\n"
+          "  --gc-stats=FILE    write GC statistics as JSON at exit, - for stderr\n"
+          "SIZE is in bytes and accepts a K, M or G suffix.\n");
+  exit(64);
+}
+
+/**
+ * @brief 解析带 K / M / G 后缀的字节数，格式错误或者超出 size_t 的范围时返回 false
+ */
+static bool parseSize(const char* text, size_t* size) {
+  char* end;
+  errno = 0;
+  unsigned long long value = strtoull(text, &end, 10);
+  if (end == text || text[0] == '-' || errno == ERANGE || value > SIZE_MAX) return false;
+
+  int shift = 0;
+  switch (*end) {
+    case 'K': case 'k': shift = 10; end++; break;
+    case 'M': case 'm': shift = 20; end++; break;
+    case 'G': case 'g': shift = 30; end++; break;
+  }
+  if (*end != '\0' || value > SIZE_MAX >> shift) return false;
+  *size = (size_t)value << shift;
+  return true;
+}
+
+/**
+ * @brief 解析一个 --gc-xxx=VALUE 选项，不认识的选项或者格式错误时返回 false
+ */
+static bool parseGCOption(const char* arg, GCConfig* config) {
+  const char* value = strchr(arg, '=');
+  if (value == NULL) return false;
+  size_t nameLength = (size_t)(value - arg);
+  value++;
+
+#define OPTION(name) \
+    (nameLength == strlen(name) && memcmp(arg, name, nameLength) == 0)
+  bool ok;
+  if (OPTION("--gc-initial")) {
+    ok = parseSize(value, &config->initialHeap);
+  } else if (OPTION("--gc-grow")) {
+    char* end;
+    config->growFactor = strtod(value, &end);
+    ok = end != value && *end == '\0' && config->growFactor > 1;
+  } else if (OPTION("--gc-min")) {
+    ok = parseSize(value, &config->minHeap);
+  } else if (OPTION("--gc-max")) {
+    ok = parseSize(value, &config->maxHeap);
+  } else if (OPTION("--gc-limit")) {
+    ok = parseSize(value, &config->heapLimit);
+  } else {
+    ok = false;
+  }
+#undef OPTION
+  return ok;
 }
 
 int main(int argc, const char* argv[]) {
-  initVM();
+  GCConfig config;
+  initGCConfig(&config);
+
+  const char* path = NULL;
+  const char* statsPath = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--gc-stats=", 11) == 0) {
+      statsPath = argv[i] + 11;
+    } else if (strncmp(argv[i], "--", 2) == 0) {
+      if (!parseGCOption(argv[i], &config)) {
+        fprintf(stderr, "Invalid option \"%s\".\n", argv[i]);
+        usage();
+      }
+    } else if (path == NULL) {
+      path = argv[i];
+    } else {
+      usage();
+    }
+  }
+  if (config.maxHeap != 0 && config.minHeap > config.maxHeap) {
+    fprintf(stderr, "--gc-min must not be larger than --gc-max.\n");
+    exit(64);
+  }
 
-  runFile("../../tests/class-method.lox");
+  initVM();
+  configureGC(&config);
 
-  // if (argc == 1) {
-  //   repl();
-  // } else if (argc == 2) {
-  //   runFile(argv[1]);
-  // } else {
-  //   fprintf(stderr, "Usage: clox [path]\n");
-  //   exit(64);
-  // }
+  int status = 0;
+  if (path == NULL) {
+    repl();
+  } else {
+    status = runFile(path);
+  }
 
+  if (statsPath != NULL) dumpGCStats(statsPath);
   freeVM();
 
-  return 0;
+  return status;
 }
\ No newline at end of file
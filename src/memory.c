@@ -1,7 +1,15 @@
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef GC_CONCURRENT
+#include <sched.h>
+#endif
 
 #include "compiler.h"
 #include "memory.h"
+#include "pool.h"
 #include "vm.h"
 
 #ifdef DEBUG_LOG_GC
@@ -9,20 +17,127 @@
 #include "debug.h"
 #endif
 
-#define GC_HEAP_GROW_FACTOR 2
+// 存活内存超过 maxHeap 之后，两次回收之间至少还能分配这么多内存，避免每次分配都触发回收
+#define GC_MIN_HEADROOM (64 * 1024)
+// 两次回收之间新分配的内存超过这个大小时，触发一次新生代回收
+#define GC_NURSERY_SIZE (256 * 1024)
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
-  vm.bytesAllocated += newSize - oldSize;
-  if (newSize > oldSize) {
-#ifdef DEBUG_STRESS_GC
-    collectGarbage();
+static uint64_t gcNow();
+static void sweepPage(PoolPage* page);
+
+#ifndef GC_INCREMENTAL
+/**
+ * @brief 并行清除的一个线程释放的内存和各类型的对象数
+ */
+typedef struct {
+  size_t bytes;
+  int objects[OBJ_TYPE_COUNT];
+} SweepTally;
+
+// 并行清除的线程把释放的内存和对象先记在各自的计数中，清除结束后统一合并
+static _Thread_local SweepTally* sweepTally = NULL;
 #endif
+
+/**
+ * @brief 扣除释放的内存
+ */
+static inline void releaseBytes(size_t size) {
+#ifndef GC_INCREMENTAL
+  if (sweepTally != NULL) {
+    sweepTally->bytes += size;
+    return;
   }
+#endif
+  vm.bytesAllocated -= size;
+  vm.gcStats.totalFreed += size;
+}
+
+/**
+ * @brief 扣除释放的对象的计数
+ */
+static inline void releaseObject(ObjType type) {
+#ifndef GC_INCREMENTAL
+  if (sweepTally != NULL) {
+    sweepTally->objects[type]++;
+    return;
+  }
+#endif
+  vm.gcStats.liveObjects[type]--;
+}
+
+size_t clampThreshold(size_t threshold, size_t live) {
+  if (threshold < vm.gcConfig.minHeap) threshold = vm.gcConfig.minHeap;
+  if (vm.gcConfig.maxHeap != 0 && threshold > vm.gcConfig.maxHeap) {
+    threshold = vm.gcConfig.maxHeap;
+    if (threshold < live + GC_MIN_HEADROOM) threshold = live + GC_MIN_HEADROOM;
+  }
+  return threshold;
+}
+
+/**
+ * @brief 按存活内存和增长系数计算下一次回收的阈值
+ */
+static size_t growThreshold(size_t live) {
+  return clampThreshold((size_t)((double)live * vm.gcConfig.growFactor), live);
+}
+
+static void collectAll();
+
+/**
+ * @brief 
+ * 超过堆的硬上限时先完整回收一次，仍然超过就记下来等 VM 在安全点报错；
+ * 报错之前不再重复回收
+ */
+static void enforceHeapLimit() {
+  if (vm.heapExhausted) return;
+  collectAll();
+  if (vm.bytesAllocated > vm.gcConfig.heapLimit) vm.heapExhausted = true;
+}
+
+/**
+ * @brief 
+ * 申请内存之前检查是否需要触发 GC；
+ * 回收过程中整理字符串驻留表也会申请内存，这时不能重入
+ */
+static void collectIfNeeded() {
+  static bool collecting = false;
+  if (collecting) return;
+  collecting = true;
+
+#ifdef DEBUG_STRESS_GC
+  collectGarbage();
+#endif
 
   if (vm.bytesAllocated > vm.nextGC) {
     collectGarbage();
   }
 
+  if (vm.gcConfig.heapLimit != 0 && vm.bytesAllocated > vm.gcConfig.heapLimit) {
+    enforceHeapLimit();
+  }
+
+  collecting = false;
+}
+
+void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+  // 只在申请内存时触发 GC，释放内存（包括 sweep 本身）时不能重入
+  if (newSize > oldSize) {
+    vm.bytesAllocated += newSize - oldSize;
+    vm.gcStats.totalAllocated += newSize - oldSize;
+    collectIfNeeded();
+  } else {
+    releaseBytes(oldSize - newSize);
+  }
+
+#ifdef POOL_ALLOCATOR
+  // 小块内存按尺寸类从内存池中分配和回收
+  if (newSize == 0) {
+    poolFree(pointer, oldSize);
+    return NULL;
+  }
+  if (pointer == NULL) return poolAllocate(newSize);
+  return poolReallocate(pointer, oldSize, newSize);
+#else
   // newSize == 0 时，清理内存
   if (newSize == 0) {
     free(pointer);
@@ -38,28 +153,217 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
   void* result = realloc(pointer, newSize);
   if (result == NULL) exit(1);
   return result;
+#endif
+}
+
+#ifdef GC_LAZY_SWEEP
+/**
+ * @brief 
+ * 对象尺寸类的空闲块用完时，逐页清除这个尺寸类中等待清除的页，
+ * 直到清除出空闲块或者这个尺寸类的页都已经清除
+ * 
+ * @param size 对象大小
+ */
+static void lazySweep(size_t size) {
+  PoolPage* page = poolNextUnsweptPage(size);
+  if (page == NULL) return;
+
+  uint64_t start = gcNow();
+  size_t before = vm.bytesAllocated;
+  do {
+    sweepPage(page);
+    vm.unsweptPages--;
+  } while ((page = poolNextUnsweptPage(size)) != NULL);
+
+  // 回收结束时的阈值是按照清除之前的内存计算的，按实际释放的内存修正
+  size_t freed = before - vm.bytesAllocated;
+  vm.gcLiveBytes -= freed < vm.gcLiveBytes ? freed : vm.gcLiveBytes;
+  vm.nextFullGC = growThreshold(vm.gcLiveBytes);
+#ifdef GC_GENERATIONAL
+  vm.nextGC -= freed;
+#else
+  vm.nextGC = vm.nextFullGC;
+#endif
+  vm.gcStats.sweepTime += gcNow() - start;
+}
+
+/**
+ * @brief 立即清除所有还在等待延迟清除的页
+ */
+static void finishLazySweep() {
+  if (vm.unsweptPages == 0) return;
+
+  uint64_t start = gcNow();
+  for (PoolPage* page = poolObjectPages(); page != NULL; page = page->next) {
+    if (!page->needsSweep) continue;
+    page->needsSweep = false;
+    sweepPage(page);
+  }
+  vm.unsweptPages = 0;
+
+  vm.gcLiveBytes = vm.bytesAllocated;
+  vm.nextFullGC = growThreshold(vm.bytesAllocated);
+  vm.gcStats.sweepTime += gcNow() - start;
+}
+#endif
+
+Obj* allocateObjectMemory(size_t size) {
+  vm.bytesAllocated += size;
+  vm.gcStats.totalAllocated += size;
+  collectIfNeeded();
+#ifdef GC_LAZY_SWEEP
+  if (vm.unsweptPages > 0 && size <= POOL_MAX_SIZE) lazySweep(size);
+#endif
+
+  Obj* object = (Obj*)poolAllocateObject(size);
+  object->isRemembered = false;
+  object->isLarge = size > POOL_MAX_SIZE;
+
+#ifdef GC_GENERATIONAL
+  // 记录新生代对象，新生代回收时只清除它们
+  if (vm.youngCapacity < vm.youngCount + 1) {
+    vm.youngCapacity = GROW_CAPACITY(vm.youngCapacity);
+    vm.youngObjects = (Obj**)realloc(vm.youngObjects, sizeof(Obj*) * vm.youngCapacity);
+    if (vm.youngObjects == NULL) exit(1);
+  }
+  vm.youngObjects[vm.youngCount++] = object;
+  // 分配到还没有清除的页中的对象一开始就带着标记，新生代回收会把它当作老年代对象，
+  // 构造时写入的引用都没有经过写屏障，放进记忆集让下一次新生代回收扫描它
+  if (isMarked(object)) rememberObject(object);
+#endif
+#ifdef GC_CONCURRENT
+  // 标记阶段分配的对象直接是黑色，并且视为本轮已经扫描过，后台线程不会读取它们；
+  // 清除阶段分配的对象同样直接标记，不会被本轮清除
+  object->scanEpoch = vm.gcEpoch;
+  if (vm.gcPhase != GC_PHASE_IDLE) setMarked(object);
+#elif defined(GC_INCREMENTAL)
+  // 清除阶段分配的对象直接标记，不会被本轮清除；下一轮开始时统一清除标记
+  if (vm.gcPhase == GC_PHASE_SWEEP) setMarked(object);
+#endif
+
+  return object;
+}
+
+void freeObjectMemory(Obj* object, size_t size) {
+  releaseBytes(size);
+  poolFreeObject(object, size);
+}
+
+void initHeapIterator(HeapIterator* iterator) {
+  iterator->page = poolObjectPages();
+  iterator->word = 0;
+  iterator->bits = iterator->page != NULL ? iterator->page->live[0] : 0;
+  iterator->large = poolLargeObjects();
+}
+
+/**
+ * @brief 64 位整数最低位的 1 所在的位置，value 不能为 0
+ */
+static inline int lowestBit(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(value);
+#else
+  int bit = 0;
+  while ((value & 1) == 0) {
+    value >>= 1;
+    bit++;
+  }
+  return bit;
+#endif
+}
+
+Obj* nextHeapObject(HeapIterator* iterator) {
+  while (iterator->page != NULL) {
+    if (iterator->bits != 0) {
+      int bit = iterator->word * 64 + lowestBit(iterator->bits);
+      iterator->bits &= iterator->bits - 1;
+      return (Obj*)poolBlockAt(iterator->page, bit);
+    }
+
+    if (++iterator->word == POOL_BITMAP_WORDS) {
+      iterator->page = iterator->page->next;
+      iterator->word = 0;
+      if (iterator->page == NULL) break;
+    }
+    iterator->bits = iterator->page->live[iterator->word];
+  }
+
+  if (iterator->large != NULL) {
+    LargeObject* large = iterator->large;
+    iterator->large = large->next;
+    return (Obj*)(large + 1);
+  }
+  return NULL;
+}
+
+/**
+ * @brief 将对象追加到一个对象数组的末尾，数组不够时扩容
+ */
+static void pushObject(Obj*** objects, int* count, int* capacity, Obj* object) {
+  if (*capacity < *count + 1) {
+    *capacity = GROW_CAPACITY(*capacity);
+    *objects = (Obj**)realloc(*objects, sizeof(Obj*) * *capacity);
+    // 无法分配内存给灰色栈时的异常处理
+    if (*objects == NULL) exit(1);
+  }
+
+  (*objects)[(*count)++] = object;
+}
+
+#ifdef GC_CONCURRENT
+/**
+ * @brief 
+ * 后台标记线程的状态：stack 是后台线程自己的灰色栈，只有它自己访问；
+ * 其余字段由 lock 保护，handoff 中是 VM 线程交给后台线程扫描的灰色对象
+ */
+static struct {
+  pthread_t thread;
+  bool started;
+  bool busy; // 正在扫描从 handoff 中取走的对象
+  bool stop;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int handoffCount;
+  int handoffCapacity;
+  Obj** handoff;
+  int count;
+  int capacity;
+  Obj** stack;
+} marker = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .wake = PTHREAD_COND_INITIALIZER,
+};
+
+// 当前线程是否是后台标记线程，决定 pushGray 压入哪个灰色栈
+static _Thread_local bool onMarkerThread = false;
+#endif
+
+/**
+ * @brief 将对象压入灰色栈，等待之后扫描它引用的对象
+ * 
+ * @param object 
+ */
+static void pushGray(Obj* object) {
+#ifdef GC_CONCURRENT
+  if (onMarkerThread) {
+    pushObject(&marker.stack, &marker.count, &marker.capacity, object);
+    return;
+  }
+#endif
+  pushObject(&vm.grayStack, &vm.grayCount, &vm.grayCapacity, object);
 }
 
 void markObject(Obj* object) {
   if (object == NULL) return;
-  if (object->isMarked) return;
+  if (isMarked(object)) return;
 #ifdef DEBUG_LOG_GC
   printf("%p mark ", (void*)object);
   printValue(OBJ_VAL(object));
   printf("\n");
 #endif
 
-  object->isMarked = true;
-
-  if (vm.grayCapacity < vm.grayCount + 1) {
-    vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
-    vm.grayStack = (Obj**)realloc(vm.grayStack, sizeof(Obj*) * vm.grayCapacity);
-  }
-
-  vm.grayStack[vm.grayCount++] = object;
-
-  // 无法分配内存给 grayStack 时的异常处理
-  if (vm.grayStack == NULL) exit(1);
+  setMarked(object);
+  pushGray(object);
 }
 
 void markValue(Value value) {
@@ -95,6 +399,7 @@ static void blackenObject(Obj* object) {
       ObjClass* klass = (ObjClass*)object;
       markObject((Obj*)klass->name);
       markTable(&klass->methods);
+      markObject((Obj*)klass->rootShape);
       break;
     }
     case OBJ_CLOSURE: {
@@ -109,24 +414,93 @@ static void blackenObject(Obj* object) {
       ObjFunction* function = (ObjFunction*)object;
       markObject((Obj*)function->name);
       markArray(&function->chunk.constants);
+      // 内联缓存强引用缓存的 shape 和方法，避免缓存指向已释放的对象
+      for (int i = 0; i < function->chunk.cacheCount; i++) {
+        InlineCache* cache = &function->chunk.caches[i];
+        for (int j = 0; j < cache->count; j++) {
+          markObject((Obj*)cache->entries[j].shape);
+          markObject((Obj*)cache->entries[j].transition);
+          markObject((Obj*)cache->entries[j].method);
+        }
+      }
       break;
     }
     case OBJ_INSTANCE: {
       ObjInstance* instance = (ObjInstance*)object;
       markObject((Obj*)instance->klass);
-      markTable(&instance->fields);
+      markObject((Obj*)instance->shape);
+      for (int i = 0; i < instance->shape->fieldCount; i++) {
+        markValue(instance->fields[i]);
+      }
+      break;
+    }
+    case OBJ_LIST:
+      markArray(&((ObjList*)object)->items);
+      break;
+    case OBJ_SHAPE: {
+      ObjShape* shape = (ObjShape*)object;
+      markTable(&shape->fields);
+      markTable(&shape->transitions);
       break;
     }
     case OBJ_UPVALUE:
       markValue(((ObjUpvalue*)object)->closed);
       break;
+    case OBJ_STRING:
+      // 还没有展开的 rope 引用左右两段，展开之后两者都是 NULL，只引用展开的结果
+      if (((ObjString*)object)->kind == STRING_ROPE) {
+        ObjRope* rope = (ObjRope*)object;
+        markObject((Obj*)rope->left);
+        markObject((Obj*)rope->right);
+        markObject((Obj*)rope->flat);
+      } else if (((ObjString*)object)->kind == STRING_SLICE) {
+        markObject((Obj*)((ObjSlice*)object)->parent);
+      }
+      break;
     // 以下不带有级联引用
     case OBJ_NATIVE:
-    case OBJ_STRING:
       break;
   }
 }
 
+#ifdef GC_CONCURRENT
+// 扫描中的对象 scanEpoch 上带有这个标志，轮次编号在 1 到 127 之间循环
+#define SCAN_BUSY 0x80
+
+/**
+ * @brief 
+ * 并发标记时扫描对象：每一轮中每个对象只扫描一次，
+ * 先把 scanEpoch 从旧值换成 本轮编号|SCAN_BUSY 占有对象，扫描结束后写回本轮编号；
+ * 对象已经扫描过或者正在被另一个线程扫描时直接返回
+ * 
+ * @param object 
+ * @return true 由当前线程完成了扫描
+ */
+static bool scanObject(Obj* object) {
+  uint8_t epoch = vm.gcEpoch;
+  uint8_t state = __atomic_load_n(&object->scanEpoch, __ATOMIC_ACQUIRE);
+  if ((state & ~SCAN_BUSY) == epoch) return false;
+  if (!__atomic_compare_exchange_n(&object->scanEpoch, &state, epoch | SCAN_BUSY,
+                                   false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+
+  blackenObject(object);
+  __atomic_store_n(&object->scanEpoch, epoch, __ATOMIC_RELEASE);
+  return true;
+}
+
+void scanBeforeWrite(Obj* object) {
+  // 能被修改的对象一定是可达的，顺便标记它
+  if (!isMarked(object)) setMarked(object);
+  while (!scanObject(object)) {
+    if (__atomic_load_n(&object->scanEpoch, __ATOMIC_ACQUIRE) == vm.gcEpoch) return;
+    // 后台线程正在扫描这个对象，等它扫描完再修改
+    sched_yield();
+  }
+}
+#endif
+
 /**
  * @brief 按照 Obj 类型清理其内存
  * 
@@ -136,45 +510,70 @@ static void freeObject(Obj* object) {
 #ifdef DEBUG_LOG_GC
   printf("%p free type %d\n", (void*)object, object->type);
 #endif
+  releaseObject(object->type);
   switch (object->type) {
     case OBJ_BOUND_METHOD:
-      FREE(ObjBoundMethod, object);
+      FREE_OBJ(ObjBoundMethod, object);
       break;
     case OBJ_CLASS: {
       ObjClass* klass = (ObjClass*)object;
       freeTable(&klass->methods);
-      FREE(ObjClass, object);
+      FREE_OBJ(ObjClass, object);
       break;
     }
     case OBJ_CLOSURE: {
       ObjClosure* closure = (ObjClosure*)object;
       FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
+      FREE_OBJ(ObjClosure, object);
       break;
     }
     case OBJ_FUNCTION: {
       ObjFunction* function = (ObjFunction*)object;
       freeChunk(&function->chunk);
-      FREE(ObjFunction, object);
+      FREE_OBJ(ObjFunction, object);
       break;
     }
     case OBJ_INSTANCE: {
       ObjInstance* instance = (ObjInstance*)object;
-      freeTable(&instance->fields);
-      FREE(ObjInstance, object);
+      if (instance->fields != instance->inlineFields) {
+        FREE_ARRAY(Value, instance->fields, instance->capacity);
+      }
+      freeObjectMemory(object, sizeof(ObjInstance) + sizeof(Value) * instance->inlineCapacity);
+      break;
+    }
+    case OBJ_LIST: {
+      freeValueArray(&((ObjList*)object)->items);
+      FREE_OBJ(ObjList, object);
       break;
     }
     case OBJ_NATIVE: {
-      FREE(ObjNative, object);
+      FREE_OBJ(ObjNative, object);
+      break;
+    }
+    case OBJ_SHAPE: {
+      ObjShape* shape = (ObjShape*)object;
+      freeTable(&shape->fields);
+      freeTable(&shape->transitions);
+      FREE_OBJ(ObjShape, object);
       break;
     }
     case OBJ_STRING: {
       ObjString* string = (ObjString*)object;
-      FREE_ARRAY(char, string->chars, string->length + 1);
-      FREE(ObjString, object);
+      switch (string->kind) {
+        case STRING_ROPE:
+          FREE_OBJ(ObjRope, object);
+          break;
+        case STRING_SLICE:
+          FREE_OBJ(ObjSlice, object);
+          break;
+        default:
+          freeObjectMemory(object, sizeof(ObjString) + string->length + 1);
+          break;
+      }
       break;
     }
     case OBJ_UPVALUE:
-      FREE(ObjUpvalue, object);
+      FREE_OBJ(ObjUpvalue, object);
       break;
   }
 }
@@ -197,8 +596,12 @@ static void markRoots() {
     markObject((Obj*)upvalue);
   }
 
-  // 标记 vm.globals 哈希表中的指针
-  markTable(&vm.globals);
+  // 标记全局变量名表和所有全局变量
+  markTable(&vm.globalNames);
+  for (int i = 0; i < vm.globalCount; i++) {
+    markObject((Obj*)vm.globals[i].name);
+    markValue(vm.globals[i].value);
+  }
   markCompilerRoots();
   markObject((Obj*)vm.initString);
 }
@@ -210,49 +613,706 @@ static void markRoots() {
 static void traceReferences() {
   while (vm.grayCount > 0) {
     Obj* object = vm.grayStack[--vm.grayCount];
+#ifdef GC_CONCURRENT
+    scanObject(object);
+#else
     blackenObject(object);
+#endif
   }
 }
 
 /**
- * @brief 清理所有没有得到标记的对象
+ * @brief 
+ * 按位图清除一页中所有存活但没有标记的对象，
+ * 只读取页头的位图，不需要访问存活对象本身
+ * 
+ * @param page 
  */
-static void sweep() {
-  Obj* previous = NULL;
-  Obj* object = vm.objects;
-  while (object != NULL) {
-    if (object->isMarked) {
-      // 重置标记
-      object->isMarked = false;
-      previous = object;
-      object = object->next;
-    } else {
-      Obj* unreached = object;
-      object = object->next;
-      if (previous != NULL) {
-        previous->next = object;
-      } else {
-        vm.objects = object;
-      }
+static void sweepPage(PoolPage* page) {
+  for (int i = 0; i < POOL_BITMAP_WORDS; i++) {
+    uint64_t dead = page->live[i] & ~page->marks[i];
+    while (dead != 0) {
+      int bit = i * 64 + lowestBit(dead);
+      dead &= dead - 1;
+      freeObject((Obj*)poolBlockAt(page, bit));
+    }
+  }
+}
 
-      freeObject(unreached);
+/**
+ * @brief 清除一个没有标记的大对象，返回链表中的下一个大对象
+ */
+static LargeObject* sweepLargeObject(LargeObject* large) {
+  LargeObject* next = large->next;
+  if (!large->isMarked) freeObject((Obj*)(large + 1));
+  return next;
+}
+
+/**
+ * @brief 当前时间，单位纳秒，用于统计 GC 停顿
+ */
+static uint64_t gcNow() {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief 记录一次 GC 停顿
+ * 
+ * @param start 停顿开始的时间
+ */
+static void recordPause(uint64_t start) {
+  uint64_t pause = gcNow() - start;
+  vm.gcStats.pauseCount++;
+  vm.gcStats.pauseTotal += pause;
+  if (pause > vm.gcStats.pauseWorst) vm.gcStats.pauseWorst = pause;
+
+  // 按微秒数的二进制位数分桶
+  uint64_t micros = pause / 1000;
+  int bucket = 0;
+  while (micros > 1 && bucket < GC_PAUSE_BUCKETS - 1) {
+    micros >>= 1;
+    bucket++;
+  }
+  vm.gcStats.pauseHistogram[bucket]++;
+}
+
+#ifdef GC_INCREMENTAL
+// 增量回收时，每新分配这么多内存就执行一个回收片段
+#define GC_STEP_SIZE (64 * 1024)
+// 每处理这么多个对象检查一次片段是否超时，避免频繁读取时钟
+#define GC_CLOCK_INTERVAL 64
+
+void rememberObject(Obj* object) {
+  // 黑色对象被整体改写后重新变灰，再扫描一遍
+  pushGray(object);
+}
+
+/**
+ * @brief 当前片段是否已经用完了停顿预算
+ * 
+ * @param start 片段开始的时间
+ * @param work 片段中已经处理的对象数
+ */
+static bool sliceExpired(uint64_t start, int work) {
+#ifdef DEBUG_STRESS_GC
+  // 压力测试时每个片段只做很少的工作，尽量让 mutator 和 GC 交错执行
+  return work >= 16;
+#else
+  if (work % GC_CLOCK_INTERVAL != 0) return false;
+  return gcNow() - start >= vm.gcSliceBudget;
+#endif
+}
+
+/**
+ * @brief 开始新一轮标记：清除上一轮的标记，标记根集合
+ */
+static void beginMark() {
+  vm.gcStats.fullCollections++;
+  poolClearMarks();
+#ifdef GC_CONCURRENT
+  vm.gcEpoch = vm.gcEpoch % 127 + 1;
+#endif
+  markRoots();
+  vm.gcPhase = GC_PHASE_MARK;
+}
+
+#ifndef GC_CONCURRENT
+/**
+ * @brief 
+ * 在预算内处理灰色栈，返回灰色栈是否已经清空
+ * 
+ * @param start 片段开始的时间
+ */
+static bool markSlice(uint64_t start) {
+  int work = 0;
+  while (vm.grayCount > 0) {
+    if (sliceExpired(start, work++)) return false;
+    Obj* object = vm.grayStack[--vm.grayCount];
+    blackenObject(object);
+  }
+  return true;
+}
+#endif
+
+/**
+ * @brief 
+ * 结束标记阶段：根集合没有写屏障，需要重新扫描一遍，
+ * 这一步的工作量只和根集合以及期间新分配的对象有关
+ */
+static void finishMark() {
+  markRoots();
+  traceReferences();
+  // 指定清除哈希表中的弱引用
+  tableRemoveWhite(&vm.strings);
+
+  vm.gcPhase = GC_PHASE_SWEEP;
+  vm.sweepPage = poolObjectPages();
+  vm.sweepLarge = poolLargeObjects();
+}
+
+/**
+ * @brief 
+ * 在预算内从 vm.sweepPage 和 vm.sweepLarge 继续清除，返回是否已经全部清除；
+ * 标记留到下一轮开始时统一清除
+ * 
+ * @param start 片段开始的时间
+ */
+static bool sweepSlice(uint64_t start) {
+  int work = 0;
+  while (vm.sweepPage != NULL) {
+    // 清除一页的工作量按照一次时钟检查间隔计算
+    if (sliceExpired(start, work)) return false;
+    work += GC_CLOCK_INTERVAL;
+    sweepPage(vm.sweepPage);
+    vm.sweepPage = vm.sweepPage->next;
+  }
+
+  while (vm.sweepLarge != NULL) {
+    if (sliceExpired(start, work++)) return false;
+    vm.sweepLarge = sweepLargeObject(vm.sweepLarge);
+  }
+  return true;
+}
+
+#ifdef GC_CONCURRENT
+// 回收请求一直等不到安全点时（例如在编译很长的脚本），
+// 新分配的内存超过这个大小就直接在 VM 线程上完成整轮标记
+#ifdef DEBUG_STRESS_GC
+#define GC_REQUEST_SLACK GC_STEP_SIZE
+#else
+#define GC_REQUEST_SLACK (16 * GC_STEP_SIZE)
+#endif
+
+/**
+ * @brief 
+ * 后台标记线程：等待 VM 线程交过来的灰色对象，一次取走全部，
+ * 扫描它们以及由此可达的对象，直到自己的灰色栈清空
+ */
+static void* markerMain(void* arg) {
+  (void)arg;
+  onMarkerThread = true;
+
+  pthread_mutex_lock(&marker.lock);
+  for (;;) {
+    marker.busy = false;
+    while (marker.handoffCount == 0 && !marker.stop) {
+      pthread_cond_wait(&marker.wake, &marker.lock);
     }
+    if (marker.stop) break;
+
+    // 自己的灰色栈此时是空的，直接和 handoff 交换
+    Obj** stack = marker.stack;
+    int capacity = marker.capacity;
+    marker.stack = marker.handoff;
+    marker.count = marker.handoffCount;
+    marker.capacity = marker.handoffCapacity;
+    marker.handoff = stack;
+    marker.handoffCount = 0;
+    marker.handoffCapacity = capacity;
+    marker.busy = true;
+    pthread_mutex_unlock(&marker.lock);
+
+    uint64_t start = gcNow();
+    int work = 0;
+    while (marker.count > 0) {
+      scanObject(marker.stack[--marker.count]);
+#ifdef DEBUG_STRESS_GC
+      // 压力测试时频繁让出 CPU，尽量让 VM 线程在标记中途修改对象
+      if (++work % 16 == 0) sched_yield();
+#else
+      (void)work;
+#endif
+    }
+
+    pthread_mutex_lock(&marker.lock);
+    vm.gcStats.concurrentMarkTime += gcNow() - start;
   }
+  pthread_mutex_unlock(&marker.lock);
+  return NULL;
 }
 
+/**
+ * @brief 把 VM 线程灰色栈中的对象交给后台线程，第一次调用时启动后台线程
+ */
+static void handOffGray() {
+  if (!marker.started) {
+    if (pthread_create(&marker.thread, NULL, markerMain, NULL) != 0) exit(1);
+    marker.started = true;
+  }
+  if (vm.grayCount == 0) return;
+
+  pthread_mutex_lock(&marker.lock);
+  for (int i = 0; i < vm.grayCount; i++) {
+    pushObject(&marker.handoff, &marker.handoffCount, &marker.handoffCapacity,
+               vm.grayStack[i]);
+  }
+  vm.grayCount = 0;
+  pthread_cond_signal(&marker.wake);
+  pthread_mutex_unlock(&marker.lock);
+}
+
+/**
+ * @brief 后台线程是否已经处理完交给它的所有对象
+ */
+static bool markerIdle() {
+  pthread_mutex_lock(&marker.lock);
+  bool idle = !marker.busy && marker.handoffCount == 0;
+  pthread_mutex_unlock(&marker.lock);
+  return idle;
+}
+
+/**
+ * @brief 通知后台线程退出并等待它结束，之后才能释放对象
+ */
+static void stopMarker() {
+  if (marker.started) {
+    pthread_mutex_lock(&marker.lock);
+    marker.stop = true;
+    pthread_cond_signal(&marker.wake);
+    pthread_mutex_unlock(&marker.lock);
+    pthread_join(marker.thread, NULL);
+    marker.started = false;
+    marker.stop = false;
+  }
+
+  free(marker.handoff);
+  free(marker.stack);
+  marker.handoff = NULL;
+  marker.handoffCount = 0;
+  marker.handoffCapacity = 0;
+  marker.stack = NULL;
+  marker.count = 0;
+  marker.capacity = 0;
+}
+
+void beginConcurrentMark() {
+  vm.gcRequested = false;
+  if (vm.gcPhase != GC_PHASE_IDLE) return;
+
+  uint64_t start = gcNow();
+  beginMark();
+  handOffGray();
+  vm.nextGC = vm.bytesAllocated + GC_STEP_SIZE;
+  vm.gcStats.markTime += gcNow() - start;
+  recordPause(start);
+}
+
+/**
+ * @brief 
+ * 空闲时请求在下一个安全点开始标记；
+ * 请求之后又分配了太多内存还没有到达安全点，就直接在 VM 线程上完成整轮标记
+ */
+static void requestMark() {
+  if (!vm.gcRequested) {
+    vm.gcRequested = true;
+    vm.gcRequestBytes = vm.bytesAllocated;
+    return;
+  }
+  if (vm.bytesAllocated - vm.gcRequestBytes < GC_REQUEST_SLACK) return;
+
+  vm.gcRequested = false;
+  beginMark();
+  traceReferences();
+  finishMark();
+}
+#endif
+
 void collectGarbage() {
+  uint64_t start = gcNow();
 #ifdef DEBUG_LOG_GC
-  printf("-- gc begin\n");
+  printf("-- gc slice begin\n");
   size_t before = vm.bytesAllocated;
 #endif
 
+#ifdef GC_CONCURRENT
+  if (vm.gcPhase == GC_PHASE_IDLE) {
+    requestMark();
+    vm.gcStats.markTime += gcNow() - start;
+  } else if (vm.gcPhase == GC_PHASE_MARK) {
+    // 把写屏障扫描出来的灰色对象交给后台线程，后台线程完成后做最后的重新标记
+    handOffGray();
+#ifdef DEBUG_STRESS_GC
+    // 压力测试时每次分配都让出 CPU，让后台线程在两次分配之间推进一小步
+    sched_yield();
+#endif
+    if (markerIdle()) finishMark();
+    vm.gcStats.markTime += gcNow() - start;
+  }
+#else
+  if (vm.gcPhase == GC_PHASE_IDLE) beginMark();
+
+  if (vm.gcPhase == GC_PHASE_MARK) {
+    if (markSlice(start)) finishMark();
+    vm.gcStats.markTime += gcNow() - start;
+  }
+#endif
+
+  if (vm.gcPhase == GC_PHASE_SWEEP) {
+    uint64_t sweepStart = gcNow();
+    if (sweepSlice(start)) vm.gcPhase = GC_PHASE_IDLE;
+    vm.gcStats.sweepTime += gcNow() - sweepStart;
+  }
+
+  if (vm.gcPhase == GC_PHASE_IDLE && !vm.gcRequested) {
+    vm.gcLiveBytes = vm.bytesAllocated;
+    vm.nextGC = growThreshold(vm.bytesAllocated);
+  } else {
+    vm.nextGC = vm.bytesAllocated + GC_STEP_SIZE;
+  }
+
+  recordPause(start);
+
+#ifdef DEBUG_LOG_GC
+  printf("-- gc slice end\n");
+  printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
+         before - vm.bytesAllocated, before, vm.bytesAllocated,
+         vm.nextGC);
+#endif
+}
+
+/**
+ * @brief 不受停顿预算限制，立即完成当前这一轮回收
+ */
+static void finishCycle() {
+  uint64_t start = gcNow();
+  if (vm.gcPhase == GC_PHASE_MARK) {
+#ifdef GC_CONCURRENT
+    // 等后台线程扫描完已经交给它的对象，剩下的在重新标记时由 VM 线程完成
+    handOffGray();
+    while (!markerIdle()) sched_yield();
+#else
+    traceReferences();
+#endif
+    finishMark();
+  }
+
+  uint64_t marked = gcNow();
+  vm.gcStats.markTime += marked - start;
+  while (vm.gcPhase == GC_PHASE_SWEEP) {
+    if (sweepSlice(gcNow())) vm.gcPhase = GC_PHASE_IDLE;
+  }
+  vm.gcStats.sweepTime += gcNow() - marked;
+}
+
+/**
+ * @brief 
+ * 完整回收整个堆：先结束进行中的一轮，它开始之后变成垃圾的对象要再回收一轮
+ */
+static void collectAll() {
+  uint64_t start = gcNow();
+  finishCycle();
+  vm.gcRequested = false;
+  beginMark();
+  finishCycle();
+
+  vm.gcLiveBytes = vm.bytesAllocated;
+  vm.nextGC = growThreshold(vm.bytesAllocated);
+  recordPause(start);
+}
+#else
+void rememberObject(Obj* object) {
+  object->isRemembered = true;
+
+  if (vm.rememberedCapacity < vm.rememberedCount + 1) {
+    vm.rememberedCapacity = GROW_CAPACITY(vm.rememberedCapacity);
+    vm.rememberedSet = (Obj**)realloc(vm.rememberedSet, sizeof(Obj*) * vm.rememberedCapacity);
+    // 无法分配内存给记忆集时的异常处理
+    if (vm.rememberedSet == NULL) exit(1);
+  }
+
+  vm.rememberedSet[vm.rememberedCount++] = object;
+}
+
+// 并行清除最多使用的线程数，包括 VM 线程自己
+#define GC_MAX_SWEEP_WORKERS 64
+
+/**
+ * @brief 
+ * 并行清除的线程池：VM 线程自己是 0 号，辅助线程在第一次并行清除时启动，
+ * 之后每一轮从 pages 中原子地领取页来清除，释放的块和内存计数都先记在各自名下
+ */
+static struct {
+  pthread_t threads[GC_MAX_SWEEP_WORKERS];
+  int threadCount; // 已经启动的辅助线程数
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  unsigned round; // 每次并行清除加一，辅助线程据此开始工作
+  int helpers; // 本轮参与的辅助线程数
+  int pending; // 本轮还没有完成的辅助线程数
+  bool stop;
+  PoolPage** pages;
+  int pageCount;
+  int pageCapacity;
+  int nextPage; // 下一个待领取的页
+  SweepTally tallies[GC_MAX_SWEEP_WORKERS];
+  PoolFreeCache caches[GC_MAX_SWEEP_WORKERS];
+} sweeper = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .start = PTHREAD_COND_INITIALIZER,
+  .done = PTHREAD_COND_INITIALIZER,
+};
+
+/**
+ * @brief 不断领取还没有清除的页并清除，直到所有的页都被领走
+ * 
+ * @param worker 线程编号，决定使用哪一份缓存和计数
+ */
+static void sweepShare(int worker) {
+  poolUseFreeCache(&sweeper.caches[worker]);
+  sweepTally = &sweeper.tallies[worker];
+
+  int index;
+  while ((index = __atomic_fetch_add(&sweeper.nextPage, 1, __ATOMIC_RELAXED)) <
+         sweeper.pageCount) {
+    PoolPage* page = sweeper.pages[index];
+    sweepPage(page);
+#ifdef GC_LAZY_SWEEP
+    // 之前按延迟清除留下的页也一起清除了
+    page->needsSweep = false;
+#endif
+  }
+
+  sweepTally = NULL;
+  poolUseFreeCache(NULL);
+}
+
+/**
+ * @brief 辅助清除线程：等待新的一轮开始，参与本轮时清除分到的页
+ */
+static void* sweeperMain(void* arg) {
+  int worker = (int)(intptr_t)arg;
+  unsigned seen = 0;
+
+  pthread_mutex_lock(&sweeper.lock);
+  for (;;) {
+    while (sweeper.round == seen && !sweeper.stop) {
+      pthread_cond_wait(&sweeper.start, &sweeper.lock);
+    }
+    if (sweeper.stop) break;
+    seen = sweeper.round;
+    if (worker > sweeper.helpers) continue;
+
+    pthread_mutex_unlock(&sweeper.lock);
+    sweepShare(worker);
+    pthread_mutex_lock(&sweeper.lock);
+    if (--sweeper.pending == 0) pthread_cond_signal(&sweeper.done);
+  }
+  pthread_mutex_unlock(&sweeper.lock);
+  return NULL;
+}
+
+/**
+ * @brief 
+ * 把所有对象页分给 workers 个线程并行清除，VM 线程也参与，
+ * 全部完成后把各线程暂存的空闲块和释放的内存合并回来
+ * 
+ * @param workers 参与清除的线程数
+ */
+static void parallelSweep(int workers) {
+  if (workers > GC_MAX_SWEEP_WORKERS) workers = GC_MAX_SWEEP_WORKERS;
+
+  int pageCount = 0;
+  for (PoolPage* page = poolObjectPages(); page != NULL; page = page->next) {
+    if (sweeper.pageCapacity < pageCount + 1) {
+      sweeper.pageCapacity = GROW_CAPACITY(sweeper.pageCapacity);
+      sweeper.pages = (PoolPage**)realloc(sweeper.pages,
+                                          sizeof(PoolPage*) * sweeper.pageCapacity);
+      if (sweeper.pages == NULL) exit(1);
+    }
+    sweeper.pages[pageCount++] = page;
+  }
+  sweeper.pageCount = pageCount;
+
+  while (sweeper.threadCount < workers - 1) {
+    intptr_t worker = sweeper.threadCount + 1;
+    if (pthread_create(&sweeper.threads[sweeper.threadCount], NULL,
+                       sweeperMain, (void*)worker) != 0) {
+      exit(1);
+    }
+    sweeper.threadCount++;
+  }
+
+  pthread_mutex_lock(&sweeper.lock);
+  sweeper.helpers = workers - 1;
+  sweeper.pending = workers - 1;
+  sweeper.nextPage = 0;
+  sweeper.round++;
+  pthread_cond_broadcast(&sweeper.start);
+  pthread_mutex_unlock(&sweeper.lock);
+
+  sweepShare(0);
+
+  pthread_mutex_lock(&sweeper.lock);
+  while (sweeper.pending > 0) {
+    pthread_cond_wait(&sweeper.done, &sweeper.lock);
+  }
+  pthread_mutex_unlock(&sweeper.lock);
+
+  for (int i = 0; i < workers; i++) {
+    poolMergeFreeCache(&sweeper.caches[i]);
+    SweepTally* tally = &sweeper.tallies[i];
+    releaseBytes(tally->bytes);
+    for (int type = 0; type < OBJ_TYPE_COUNT; type++) {
+      vm.gcStats.liveObjects[type] -= tally->objects[type];
+    }
+    memset(tally, 0, sizeof(SweepTally));
+  }
+#ifdef GC_LAZY_SWEEP
+  vm.unsweptPages = 0;
+#endif
+}
+
+/**
+ * @brief 通知辅助清除线程退出并等待它们结束
+ */
+static void stopSweepers() {
+  pthread_mutex_lock(&sweeper.lock);
+  sweeper.stop = true;
+  pthread_cond_broadcast(&sweeper.start);
+  pthread_mutex_unlock(&sweeper.lock);
+  for (int i = 0; i < sweeper.threadCount; i++) {
+    pthread_join(sweeper.threads[i], NULL);
+  }
+  sweeper.threadCount = 0;
+  sweeper.stop = false;
+
+  free(sweeper.pages);
+  sweeper.pages = NULL;
+  sweeper.pageCount = 0;
+  sweeper.pageCapacity = 0;
+}
+
+/**
+ * @brief 
+ * 清除所有没有标记的对象；存活对象保留标记，在下一次完整回收之前都视为老年代。
+ * vm.gcSweepWorkers 大于 1 时对象页由多个线程并行清除；
+ * 否则延迟清除时只立即清除大对象，对象页留给分配器按需清除
+ */
+static void sweep() {
+  if (vm.gcSweepWorkers > 1) {
+    parallelSweep(vm.gcSweepWorkers);
+  } else {
+#ifdef GC_LAZY_SWEEP
+    vm.unsweptPages = poolBeginLazySweep();
+#else
+    for (PoolPage* page = poolObjectPages(); page != NULL; page = page->next) {
+      sweepPage(page);
+    }
+#endif
+  }
+
+  LargeObject* large = poolLargeObjects();
+  while (large != NULL) {
+    large = sweepLargeObject(large);
+  }
+}
+
+#ifdef GC_GENERATIONAL
+void writeBarrierSlow(Obj* object, Obj* value) {
+  if (isMarked(object) && !isMarked(value)) {
+    rememberObject(object);
+  }
+}
+#endif
+
+/**
+ * @brief 清空记忆集
+ */
+static void clearRememberedSet() {
+  for (int i = 0; i < vm.rememberedCount; i++) {
+    vm.rememberedSet[i]->isRemembered = false;
+  }
+  vm.rememberedCount = 0;
+}
+
+#ifdef GC_GENERATIONAL
+/**
+ * @brief 
+ * 新生代回收：老年代对象都带着标记，markObject 不会进入它们，
+ * 只追踪从根和记忆集可达的新生代对象，然后只清理新生代；
+ * 存活下来的新生代对象保留标记，即晋升到老年代
+ */
+static void collectYoung() {
+  uint64_t start = gcNow();
+  vm.gcStats.youngCollections++;
+  markRoots();
+
+  // 记忆集里的老年代对象可能引用了新生代对象，需要重新扫描它们
+  for (int i = 0; i < vm.rememberedCount; i++) {
+    blackenObject(vm.rememberedSet[i]);
+  }
+  clearRememberedSet();
+
+  traceReferences();
+  // 指定清除哈希表中的弱引用，老年代的字符串带着标记，不会被清除
+  tableRemoveWhite(&vm.strings);
+  uint64_t marked = gcNow();
+  vm.gcStats.markTime += marked - start;
+
+  // 只需要检查新生代对象，存活的保留标记，即晋升到老年代
+  for (int i = vm.youngCount - 1; i >= 0; i--) {
+    Obj* object = vm.youngObjects[i];
+    if (!isMarked(object)) freeObject(object);
+  }
+  vm.gcStats.sweepTime += gcNow() - marked;
+}
+#endif
+
+/**
+ * @brief 完整回收：清除所有标记后对整个堆做一次标记-清除
+ */
+static void collectFull() {
+  uint64_t start = gcNow();
+  vm.gcStats.fullCollections++;
+  poolClearMarks();
+  // 完整回收会扫描所有对象，不再需要记忆集
+  clearRememberedSet();
+
   markRoots();
   traceReferences();
   // 指定清除哈希表中的弱引用
   tableRemoveWhite(&vm.strings);
+  uint64_t marked = gcNow();
+  vm.gcStats.markTime += marked - start;
   sweep();
+  vm.gcStats.sweepTime += gcNow() - marked;
 
-  vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+  vm.gcLiveBytes = vm.bytesAllocated;
+  vm.nextFullGC = growThreshold(vm.bytesAllocated);
+}
+
+void collectGarbage() {
+  uint64_t start = gcNow();
+#ifdef DEBUG_LOG_GC
+  printf("-- gc begin\n");
+  size_t before = vm.bytesAllocated;
+#endif
+
+#ifdef GC_GENERATIONAL
+  bool full = vm.bytesAllocated > vm.nextFullGC;
+#ifdef DEBUG_STRESS_GC
+  // 压力测试时也定期做完整回收，覆盖两种路径
+  static int stressCount = 0;
+  if (++stressCount % 8 == 0) full = true;
+#endif
+
+  if (full) {
+    collectFull();
+  } else {
+    collectYoung();
+  }
+  // 存活的对象都已晋升
+  vm.youngCount = 0;
+  vm.nextGC = vm.bytesAllocated + GC_NURSERY_SIZE;
+#else
+  collectFull();
+  vm.nextGC = vm.nextFullGC;
+#endif
+
+  recordPause(start);
 
 #ifdef DEBUG_LOG_GC
   printf("-- gc end\n");
@@ -262,13 +1322,52 @@ void collectGarbage() {
 #endif
 }
 
+/**
+ * @brief 完整回收并且立即清除整个堆，不留给延迟清除
+ */
+static void collectAll() {
+  uint64_t start = gcNow();
+  collectFull();
+#ifdef GC_LAZY_SWEEP
+  finishLazySweep();
+#endif
+
+#ifdef GC_GENERATIONAL
+  vm.youngCount = 0;
+  vm.nextGC = vm.bytesAllocated + GC_NURSERY_SIZE;
+#else
+  vm.nextGC = vm.nextFullGC;
+#endif
+  recordPause(start);
+}
+#endif
+
+void readGCStats(GCStats* stats) {
+#ifdef GC_CONCURRENT
+  // 后台线程持有锁时累加并发标记的时间
+  pthread_mutex_lock(&marker.lock);
+  *stats = vm.gcStats;
+  pthread_mutex_unlock(&marker.lock);
+#else
+  *stats = vm.gcStats;
+#endif
+}
+
 void freeObjects() {
-  Obj* object = vm.objects;
-  while (object != NULL) {
-    Obj* next = object->next;
+#ifdef GC_CONCURRENT
+  stopMarker();
+#elif !defined(GC_INCREMENTAL)
+  stopSweepers();
+#endif
+  HeapIterator iterator;
+  initHeapIterator(&iterator);
+  Obj* object;
+  while ((object = nextHeapObject(&iterator)) != NULL) {
     freeObject(object);
-    object = next;
   }
 
   free(vm.grayStack);
-}
\ No newline at end of file
+  free(vm.rememberedSet);
+  free(vm.youngObjects);
+  freePool();
+}
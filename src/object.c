@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "memory.h"
@@ -10,6 +11,13 @@
 #define ALLOCATE_OBJ(type, objectType) \
     (type*)allocateObject(sizeof(type), objectType)
 
+// 拼接结果短于这个长度时直接复制字符，不值得再建一个 rope 节点
+#define ROPE_MIN_LENGTH 32
+// 展开 rope 时先用栈上的数组保存待处理的节点，不够时才从堆上分配
+#define ROPE_STACK_SIZE 64
+// 子串短于这个长度时直接复制字符，复制出来的字符串不比切片对象大
+#define SLICE_MIN_LENGTH 16
+
 /**
  * @brief 在堆内创建一个新的 Obj, 并初始化
  * 
@@ -18,12 +26,9 @@
  * @return Obj* 
  */
 static Obj* allocateObject(size_t size, ObjType type) {
-  Obj* object = (Obj*)reallocate(NULL, 0, size);
+  Obj* object = allocateObjectMemory(size);
   object->type = type;
-  object->isMarked = false;
-
-  object->next = vm.objects;
-  vm.objects = object;
+  vm.gcStats.liveObjects[type]++;
 
 #ifdef DEBUG_LOG_GC
   printf("%p allocate %zu for %d\n", (void*)object, size, type);
@@ -43,6 +48,13 @@ ObjClass* newClass(ObjString* name) {
   ObjClass* klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
   klass->name = name; 
   initTable(&klass->methods);
+  klass->rootShape = NULL;
+  klass->fieldHint = 0;
+
+  push(OBJ_VAL(klass));
+  klass->rootShape = newShape();
+  writeBarrierObject((Obj*)klass);
+  pop();
   return klass;
 }
 
@@ -69,32 +81,242 @@ ObjFunction* newFunction() {
 }
 
 ObjInstance* newInstance(ObjClass* klass) {
-  ObjInstance* instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
+  int inlineCapacity = klass->fieldHint;
+  ObjInstance* instance = (ObjInstance*)allocateObject(
+      sizeof(ObjInstance) + sizeof(Value) * inlineCapacity, OBJ_INSTANCE);
   instance->klass = klass;
-  initTable(&instance->fields);
+  instance->shape = klass->rootShape;
+  instance->fields = instance->inlineFields;
+  instance->capacity = inlineCapacity;
+  instance->inlineCapacity = inlineCapacity;
   return instance;
 }
 
+/**
+ * @brief 内联槽位不够时，把字段迁移到单独分配的数组中
+ * 
+ * @param instance 实例
+ * @param count 需要容纳的字段数
+ */
+static void growInstanceFields(ObjInstance* instance, int count) {
+  int capacity = GROW_CAPACITY(instance->capacity);
+  while (capacity < count) capacity *= 2;
+
+  Value* fields = ALLOCATE(Value, capacity);
+  memcpy(fields, instance->fields, sizeof(Value) * instance->shape->fieldCount);
+  if (instance->fields != instance->inlineFields) {
+    FREE_ARRAY(Value, instance->fields, instance->capacity);
+  }
+  instance->fields = fields;
+  instance->capacity = capacity;
+}
+
+void instanceAddField(ObjInstance* instance, ObjShape* shape, Value value) {
+  preWriteBarrier((Obj*)instance);
+  if (shape->fieldCount > instance->capacity) {
+    growInstanceFields(instance, shape->fieldCount);
+  }
+
+  instance->fields[shape->fieldCount - 1] = value;
+  instance->shape = shape;
+  // 新的 shape 和字段值都可能是新生代对象
+  writeBarrierObject((Obj*)instance);
+
+  if (shape->fieldCount > instance->klass->fieldHint) {
+    instance->klass->fieldHint = shape->fieldCount;
+  }
+}
+
+ObjList* newList() {
+  ObjList* list = ALLOCATE_OBJ(ObjList, OBJ_LIST);
+  initValueArray(&list->items);
+  return list;
+}
+
+void listAppend(ObjList* list, Value value) {
+  // 并发标记时先扫描列表，扩容时后台线程不会再读取旧的数组
+  preWriteBarrier((Obj*)list);
+  writeValueArray(&list->items, value);
+  writeBarrier((Obj*)list, value);
+}
+
 ObjNative* newNative(NativeFn function) {
   ObjNative* native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
   native->function = function;
   return native;
 }
 
-static ObjString* allocateString(char* chars, int length, uint32_t hash) {
-  ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+// 小表的内联数组不能让 shape 超出内存池的尺寸类，否则每个 shape 都要单独 malloc
+_Static_assert(sizeof(ObjShape) <= POOL_MAX_SIZE, "ObjShape must fit in a pool size class");
+
+ObjShape* newShape() {
+  ObjShape* shape = ALLOCATE_OBJ(ObjShape, OBJ_SHAPE);
+  shape->fieldCount = 0;
+  initTable(&shape->fields);
+  initTable(&shape->transitions);
+  return shape;
+}
+
+int shapeFieldIndex(ObjShape* shape, ObjString* name) {
+  Value index;
+  if (!tableGet(&shape->fields, name, &index)) return -1;
+  return (int)AS_NUMBER(index);
+}
+
+ObjShape* shapeAddField(ObjShape* shape, ObjString* name) {
+  Value existing;
+  if (tableGet(&shape->transitions, name, &existing)) {
+    return AS_SHAPE(existing);
+  }
+
+  ObjShape* child = newShape();
+  push(OBJ_VAL(child));
+  tableAddAll(&shape->fields, &child->fields);
+  tableSet(&child->fields, name, NUMBER_VAL(shape->fieldCount));
+  child->fieldCount = shape->fieldCount + 1;
+  preWriteBarrier((Obj*)shape);
+  tableSet(&shape->transitions, name, OBJ_VAL(child));
+  writeBarrierObject((Obj*)child);
+  writeBarrierObject((Obj*)shape);
+  pop();
+  return child;
+}
+
+// ObjRope、ObjSlice 和 ObjString 共用头部，按 ObjString 读取长度、哈希值和存储方式
+_Static_assert(offsetof(ObjRope, length) == offsetof(ObjString, length), "ObjRope header");
+_Static_assert(offsetof(ObjRope, hash) == offsetof(ObjString, hash), "ObjRope header");
+_Static_assert(offsetof(ObjRope, kind) == offsetof(ObjString, kind), "ObjRope header");
+_Static_assert(offsetof(ObjRope, hashed) == offsetof(ObjString, hashed), "ObjRope header");
+_Static_assert(offsetof(ObjRope, interned) == offsetof(ObjString, interned), "ObjRope header");
+_Static_assert(offsetof(ObjSlice, length) == offsetof(ObjString, length), "ObjSlice header");
+_Static_assert(offsetof(ObjSlice, hash) == offsetof(ObjString, hash), "ObjSlice header");
+_Static_assert(offsetof(ObjSlice, kind) == offsetof(ObjString, kind), "ObjSlice header");
+_Static_assert(offsetof(ObjSlice, hashed) == offsetof(ObjString, hashed), "ObjSlice header");
+_Static_assert(offsetof(ObjSlice, interned) == offsetof(ObjString, interned), "ObjSlice header");
+
+/**
+ * @brief 
+ * 创建一个不进入字符串驻留表、还没有计算哈希值的字符串，字符和头部一起分配，
+ * 由调用方写入 length 个字符
+ */
+static ObjString* newString(int length) {
+  ObjString* string = (ObjString*)allocateObject(
+      sizeof(ObjString) + length + 1, OBJ_STRING);
   string->length = length;
-  string->chars = chars;
-  string->hash = hash;
+  string->hash = 0;
+  string->kind = STRING_FLAT;
+  string->hashed = false;
+  string->interned = false;
+  string->chars[length] = '\0';
+  return string;
+}
 
+/**
+ * @brief 把 string 加入字符串驻留表，string 必须是 STRING_FLAT 并且已经计算了哈希值
+ */
+static void addInterned(ObjString* string) {
+  string->interned = true;
   push(OBJ_VAL(string));
   tableSet(&vm.strings, string, NIL_VAL);
   pop();
+}
 
-  return string;
+#ifdef WORD_HASH
+// wyhash 使用的常数
+#define HASH_SECRET0 0xa0761d6478bd642full
+#define HASH_SECRET1 0xe7037ed1a0b428dbull
+#define HASH_SECRET2 0x8ebc6af09c88c6e3ull
+#define HASH_SECRET3 0x589965cc75374cc3ull
+
+/**
+ * @brief 64 位乘法得到 128 位的结果，低 64 位存入 a，高 64 位存入 b
+ */
+static inline void hashMultiply(uint64_t* a, uint64_t* b) {
+#ifdef __SIZEOF_INT128__
+  __uint128_t product = (__uint128_t)*a * *b;
+  *a = (uint64_t)product;
+  *b = (uint64_t)(product >> 64);
+#else
+  uint64_t aHigh = *a >> 32, aLow = (uint32_t)*a;
+  uint64_t bHigh = *b >> 32, bLow = (uint32_t)*b;
+  uint64_t high = aHigh * bHigh, low = aLow * bLow;
+  uint64_t middle1 = aHigh * bLow, middle2 = aLow * bHigh;
+  uint64_t carry = ((low >> 32) + (uint32_t)middle1 + (uint32_t)middle2) >> 32;
+  *a = low + (middle1 << 32) + (middle2 << 32);
+  *b = high + (middle1 >> 32) + (middle2 >> 32) + carry;
+#endif
+}
+
+/**
+ * @brief 128 位乘积的高低两半异或
+ */
+static inline uint64_t hashMix(uint64_t a, uint64_t b) {
+  hashMultiply(&a, &b);
+  return a ^ b;
+}
+
+// 按机器字节序读取，只影响哈希值本身，不影响正确性；memcpy 会被编译成一条非对齐读取
+static inline uint64_t read64(const uint8_t* p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint64_t read32(const uint8_t* p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
 }
 
-static uint32_t hashString(const char* key, int length) {
+uint32_t hashString(const char* key, int length) {
+  const uint8_t* p = (const uint8_t*)key;
+  size_t remaining = (size_t)length;
+  uint64_t seed = hashMix(HASH_SECRET0, HASH_SECRET1);
+  uint64_t a, b;
+
+  if (remaining <= 16) {
+    // 短字符串用首尾可能重叠的几次读取覆盖全部字节，不读越界也不逐字节循环
+    if (remaining >= 4) {
+      size_t offset = (remaining >> 3) << 2;
+      a = (read32(p) << 32) | read32(p + offset);
+      b = (read32(p + remaining - 4) << 32) | read32(p + remaining - 4 - offset);
+    } else if (remaining > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[remaining >> 1] << 8) | p[remaining - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    if (remaining > 48) {
+      // 三条互不依赖的乘法链，每轮处理 48 字节
+      uint64_t seed1 = seed, seed2 = seed;
+      do {
+        seed = hashMix(read64(p) ^ HASH_SECRET1, read64(p + 8) ^ seed);
+        seed1 = hashMix(read64(p + 16) ^ HASH_SECRET2, read64(p + 24) ^ seed1);
+        seed2 = hashMix(read64(p + 32) ^ HASH_SECRET3, read64(p + 40) ^ seed2);
+        p += 48;
+        remaining -= 48;
+      } while (remaining > 48);
+      seed ^= seed1 ^ seed2;
+    }
+    while (remaining > 16) {
+      seed = hashMix(read64(p) ^ HASH_SECRET1, read64(p + 8) ^ seed);
+      p += 16;
+      remaining -= 16;
+    }
+    // 最后 16 字节和前面处理过的部分重叠
+    a = read64(p + remaining - 16);
+    b = read64(p + remaining - 8);
+  }
+
+  a ^= HASH_SECRET1;
+  b ^= seed;
+  hashMultiply(&a, &b);
+  uint64_t hash = hashMix(a ^ HASH_SECRET0 ^ (uint64_t)length, b ^ HASH_SECRET1);
+  return (uint32_t)(hash ^ (hash >> 32));
+}
+#else
+uint32_t hashString(const char* key, int length) {
   uint32_t hash = 2166136261u;
   for (int i = 0; i < length; i++) {
     hash ^= (uint8_t)key[i];
@@ -102,20 +324,203 @@ static uint32_t hashString(const char* key, int length) {
   }
   return hash;
 }
+#endif
 
-ObjString* takeString(char* chars, int length) {
-  uint32_t hash = hashString(chars, length);
-  return allocateString(chars, length, hash);
+/**
+ * @brief 在字符串驻留表中查找内容相同的字符串，没有时复制一份加入驻留表
+ */
+static ObjString* internChars(const char* chars, int length, uint32_t hash) {
+  ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+  if (interned != NULL) {
+    shadeObject((Obj*)interned);
+    return interned;
+  }
+  ObjString* string = newString(length);
+  memcpy(string->chars, chars, length);
+  string->hash = hash;
+  string->hashed = true;
+  addInterned(string);
+  return string;
 }
 
 ObjString* copyString(const char* chars, int length) {
-  uint32_t hash = hashString(chars, length);
-  ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
-  if (interned != NULL) return interned;
-  char* heapChars = ALLOCATE(char, length + 1);
-  memcpy(heapChars, chars, length);
-  heapChars[length] = '\0';
-  return allocateString(heapChars, length, hash);
+  return internChars(chars, length, hashString(chars, length));
+}
+
+ObjString* internString(ObjString* string) {
+  if (string->interned) return string;
+  string = flattenString(string);
+  if (string->kind == STRING_SLICE) {
+    return internChars(stringChars(string), string->length, stringHash(string));
+  }
+
+  ObjString* interned = tableFindString(&vm.strings, string->chars, string->length,
+                                        stringHash(string));
+  if (interned != NULL) {
+    shadeObject((Obj*)interned);
+    return interned;
+  }
+  // 拼接的结果没有进入驻留表，直接把它本身加进去
+  addInterned(string);
+  return string;
+}
+
+uint32_t stringHash(ObjString* string) {
+  if (!string->hashed) {
+    const char* chars = stringChars(string);
+    string->hash = hashString(chars, string->length);
+    string->hashed = true;
+  }
+  return string->hash;
+}
+
+/**
+ * @brief 
+ * 把 string 的全部字符复制到 dest：从右往左复制，左边的节点压栈，
+ * 循环中拼接出来的 rope 向左延伸，这样待处理的节点很少；
+ * 只用原始的 malloc 扩展节点栈，不会触发 GC
+ * 
+ * @param string 字符串、rope 或者切片
+ * @param dest 至少 string->length 字节
+ */
+static void copyChars(ObjString* string, char* dest) {
+  ObjString* initial[ROPE_STACK_SIZE];
+  ObjString** stack = initial;
+  int capacity = ROPE_STACK_SIZE;
+  int count = 0;
+  int end = string->length;
+
+  for (ObjString* node = string;;) {
+    if (node->kind == STRING_ROPE && ((ObjRope*)node)->flat != NULL) {
+      node = ((ObjRope*)node)->flat;
+    }
+    if (node->kind != STRING_ROPE) {
+      end -= node->length;
+      memcpy(dest + end, stringChars(node), node->length);
+      if (count == 0) break;
+      node = stack[--count];
+      continue;
+    }
+
+    if (count == capacity) {
+      capacity *= 2;
+      ObjString** grown = (ObjString**)malloc(sizeof(ObjString*) * capacity);
+      if (grown == NULL) exit(1);
+      memcpy(grown, stack, sizeof(ObjString*) * count);
+      if (stack != initial) free(stack);
+      stack = grown;
+    }
+    ObjRope* rope = (ObjRope*)node;
+    stack[count++] = rope->left;
+    node = rope->right;
+  }
+
+  if (stack != initial) free(stack);
+}
+
+ObjString* concatenateStrings(ObjString* a, ObjString* b) {
+  if (a->length == 0) return b;
+  if (b->length == 0) return a;
+
+  int length = a->length + b->length;
+#ifdef ROPE_STRING
+  if (length >= ROPE_MIN_LENGTH) {
+    ObjRope* rope = ALLOCATE_OBJ(ObjRope, OBJ_STRING);
+    rope->length = length;
+    rope->hash = 0;
+    rope->kind = STRING_ROPE;
+    rope->hashed = false;
+    rope->interned = false;
+    rope->left = a;
+    rope->right = b;
+    rope->flat = NULL;
+    return (ObjString*)rope;
+  }
+#endif
+
+  ObjString* string = newString(length);
+  copyChars(a, string->chars);
+  copyChars(b, string->chars + a->length);
+  return string;
+}
+
+ObjString* sliceString(ObjString* string, int start, int length) {
+  if (start == 0 && length == string->length) return string;
+
+#ifdef SLICE_STRING
+  if (length >= SLICE_MIN_LENGTH) {
+    // 切片总是直接引用 STRING_FLAT 的字符串，切片的切片也指向最初的字符串
+    ObjString* parent = flattenString(string);
+    if (parent->kind == STRING_SLICE) {
+      start += ((ObjSlice*)parent)->start;
+      parent = ((ObjSlice*)parent)->parent;
+    }
+    ObjSlice* slice = ALLOCATE_OBJ(ObjSlice, OBJ_STRING);
+    slice->length = length;
+    slice->hash = 0;
+    slice->kind = STRING_SLICE;
+    slice->hashed = false;
+    slice->interned = false;
+    slice->parent = parent;
+    slice->start = start;
+    return (ObjString*)slice;
+  }
+#endif
+
+  const char* chars = stringChars(string);
+  ObjString* result = newString(length);
+  memcpy(result->chars, chars + start, length);
+  return result;
+}
+
+ObjString* flattenString(ObjString* string) {
+  if (string->kind != STRING_ROPE) return string;
+  ObjRope* rope = (ObjRope*)string;
+  if (rope->flat != NULL) return rope->flat;
+
+  ObjString* flat = newString(string->length);
+  copyChars(string, flat->chars);
+
+  // 并发标记时先扫描 rope，保证左右两段在本轮仍然会被标记
+  preWriteBarrier((Obj*)rope);
+  rope->left = NULL;
+  rope->right = NULL;
+  rope->flat = flat;
+  writeBarrier((Obj*)rope, OBJ_VAL(flat));
+  return flat;
+}
+
+bool stringsEqual(ObjString* a, ObjString* b) {
+  if (a == b) return true;
+  if (a->length != b->length) return false;
+
+  // 内容相同的驻留字符串是同一个对象
+  if (a->interned && b->interned) return false;
+  // 只用已经算好的哈希值排除，不为了比较去计算
+  if (a->hashed && b->hashed && a->hash != b->hash) return false;
+
+  const char* aChars = stringChars(a);
+  const char* bChars = stringChars(b);
+  return memcmp(aChars, bChars, a->length) == 0;
+}
+
+/**
+ * @brief 输出字符串，rope 复制到临时的缓冲区中输出，不展开也不触发 GC
+ */
+static void printString(ObjString* string) {
+  if (string->kind == STRING_ROPE && ((ObjRope*)string)->flat != NULL) {
+    string = ((ObjRope*)string)->flat;
+  }
+  if (string->kind != STRING_ROPE) {
+    fwrite(stringChars(string), 1, string->length, stdout);
+    return;
+  }
+
+  char* chars = (char*)malloc(string->length);
+  if (chars == NULL) exit(1);
+  copyChars(string, chars);
+  fwrite(chars, 1, string->length, stdout);
+  free(chars);
 }
 
 ObjUpvalue* newUpvalue(Value* slot) {
@@ -126,6 +531,33 @@ ObjUpvalue* newUpvalue(Value* slot) {
   return upvalue;
 }
 
+// 正在输出的列表，列表直接或间接包含自己时输出 [...]
+#define PRINT_LIST_DEPTH 64
+static ObjList* printingLists[PRINT_LIST_DEPTH];
+static int printingListCount = 0;
+
+static void printList(ObjList* list) {
+  for (int i = 0; i < printingListCount; i++) {
+    if (printingLists[i] == list) {
+      printf("[...]");
+      return;
+    }
+  }
+  if (printingListCount == PRINT_LIST_DEPTH) {
+    printf("[...]");
+    return;
+  }
+
+  printingLists[printingListCount++] = list;
+  printf("[");
+  for (int i = 0; i < list->items.count; i++) {
+    if (i > 0) printf(", ");
+    printValue(list->items.values[i]);
+  }
+  printf("]");
+  printingListCount--;
+}
+
 static void printFunction(ObjFunction* function) {
   if (function -> name == NULL) {
     printf("<script>");
@@ -151,11 +583,17 @@ void printObject(Value value) {
     case OBJ_INSTANCE:
       printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
       break;
+    case OBJ_LIST:
+      printList(AS_LIST(value));
+      break;
     case OBJ_NATIVE:
       printf("<native fn>");
       break;
+    case OBJ_SHAPE:
+      printf("shape");
+      break;
     case OBJ_STRING:
-      printf("%s", AS_CSTRING(value));
+      printString(AS_STRING(value));
       break;
     case OBJ_UPVALUE:
       printf("upvalue");
@@ -0,0 +1,341 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+#define POOL_ASAN
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define POOL_ASAN
+#endif
+#endif
+
+// 在 AddressSanitizer 下把空闲的块标记为不可访问，保留 use-after-free 检查
+#ifdef POOL_ASAN
+#include <sanitizer/asan_interface.h>
+#define POISON(pointer, size) ASAN_POISON_MEMORY_REGION(pointer, size)
+#define UNPOISON(pointer, size) ASAN_UNPOISON_MEMORY_REGION(pointer, size)
+#else
+#define POISON(pointer, size) ((void)(pointer), (void)(size))
+#define UNPOISON(pointer, size) ((void)(pointer), (void)(size))
+#endif
+
+/**
+ * @brief 空闲块，next 指针直接存放在块的内存中
+ */
+typedef struct PoolBlock {
+  struct PoolBlock* next;
+} PoolBlock;
+
+/**
+ * @brief 一个尺寸类的分配状态
+ */
+typedef struct {
+  PoolBlock* freeList; // 释放后可以复用的块
+  char* bump; // 当前页中还没有切分出去的位置
+  char* end;
+  PoolPage* pages; // 对象页按尺寸类串起来的链表
+  PoolPage* unswept; // 延迟清除时下一个等待清除的页
+} PoolClass;
+
+// 页头之后第一个块的偏移，保证块按照 POOL_GRANULE 对齐
+#define POOL_PAGE_HEADER \
+    ((sizeof(PoolPage) + POOL_GRANULE - 1) / POOL_GRANULE * POOL_GRANULE)
+
+// 普通内存和 GC 对象分别使用不同的页，对象页只存放对象，可以按位图清除
+static PoolClass classes[POOL_CLASS_COUNT];
+static PoolClass objectClasses[POOL_CLASS_COUNT];
+static PoolPage* pages = NULL;
+static PoolPage* objectPages = NULL;
+static LargeObject* largeObjects = NULL;
+// 当前线程释放小块时使用的缓存，见 poolUseFreeCache
+static _Thread_local PoolFreeCache* freeCache = NULL;
+
+/**
+ * @brief 计算大小对应的尺寸类下标
+ */
+static inline int sizeClassOf(size_t size) {
+  return (int)((size - 1) / POOL_GRANULE);
+}
+
+static inline size_t blockSizeOf(int sizeClass) {
+  return (size_t)(sizeClass + 1) * POOL_GRANULE;
+}
+
+/**
+ * @brief 为尺寸类申请新的一页，之后从这一页中顺序切分块
+ * 
+ * @param poolClass 尺寸类
+ * @param sizeClass 尺寸类下标
+ * @param list 新页插入的页链表
+ */
+static void newPage(PoolClass* poolClass, int sizeClass, PoolPage** list) {
+  PoolPage* page = (PoolPage*)aligned_alloc(POOL_PAGE_SIZE, POOL_PAGE_SIZE);
+  if (page == NULL) exit(1);
+
+  page->sizeClass = sizeClass;
+  page->needsSweep = false;
+  page->classNext = poolClass->pages;
+  poolClass->pages = page;
+  memset(page->live, 0, sizeof(page->live));
+  memset(page->marks, 0, sizeof(page->marks));
+  page->next = *list;
+  *list = page;
+
+  poolClass->bump = (char*)page + POOL_PAGE_HEADER;
+  poolClass->end = (char*)page + POOL_PAGE_SIZE;
+  POISON(poolClass->bump, poolClass->end - poolClass->bump);
+}
+
+/**
+ * @brief 从尺寸类中取出一个块，优先复用空闲链表
+ */
+static void* allocateBlock(PoolClass* poolClass, int sizeClass, PoolPage** list) {
+  size_t blockSize = blockSizeOf(sizeClass);
+
+  // 优先复用释放过的块
+  if (poolClass->freeList != NULL) {
+    PoolBlock* block = poolClass->freeList;
+    UNPOISON(block, blockSize);
+    poolClass->freeList = block->next;
+    return block;
+  }
+
+  if (poolClass->bump + blockSize > poolClass->end) {
+    newPage(poolClass, sizeClass, list);
+  }
+
+  void* block = poolClass->bump;
+  poolClass->bump += blockSize;
+  UNPOISON(block, blockSize);
+  return block;
+}
+
+/**
+ * @brief 把块放回尺寸类的空闲链表
+ */
+static void freeBlock(PoolClass* poolClass, int sizeClass, void* pointer) {
+  PoolBlock* block = (PoolBlock*)pointer;
+  block->next = poolClass->freeList;
+  poolClass->freeList = block;
+  POISON(block, blockSizeOf(sizeClass));
+}
+
+/**
+ * @brief 把块放入线程自己的缓存，之后由 poolMergeFreeCache 并入内存池
+ */
+static void cacheBlock(PoolFreeList* list, int sizeClass, void* pointer) {
+  PoolBlock* block = (PoolBlock*)pointer;
+  block->next = (PoolBlock*)list->head;
+  list->head = block;
+  if (list->tail == NULL) list->tail = block;
+  POISON(block, blockSizeOf(sizeClass));
+}
+
+/**
+ * @brief 把暂存的链表整体接到尺寸类空闲链表的前面
+ */
+static void mergeFreeList(PoolClass* poolClass, PoolFreeList* list, int sizeClass) {
+  if (list->head == NULL) return;
+
+  PoolBlock* tail = (PoolBlock*)list->tail;
+  UNPOISON(tail, blockSizeOf(sizeClass));
+  tail->next = poolClass->freeList;
+  POISON(tail, blockSizeOf(sizeClass));
+  poolClass->freeList = (PoolBlock*)list->head;
+  list->head = NULL;
+  list->tail = NULL;
+}
+
+void* poolAllocate(size_t size) {
+  if (size > POOL_MAX_SIZE) {
+    void* result = malloc(size);
+    if (result == NULL) exit(1);
+    return result;
+  }
+
+  int sizeClass = sizeClassOf(size);
+  return allocateBlock(&classes[sizeClass], sizeClass, &pages);
+}
+
+void poolFree(void* pointer, size_t size) {
+  if (pointer == NULL) return;
+  if (size > POOL_MAX_SIZE) {
+    free(pointer);
+    return;
+  }
+
+  int sizeClass = sizeClassOf(size);
+  if (freeCache != NULL) {
+    cacheBlock(&freeCache->raw[sizeClass], sizeClass, pointer);
+    return;
+  }
+  freeBlock(&classes[sizeClass], sizeClass, pointer);
+}
+
+void* poolReallocate(void* pointer, size_t oldSize, size_t newSize) {
+  if (oldSize > POOL_MAX_SIZE && newSize > POOL_MAX_SIZE) {
+    void* result = realloc(pointer, newSize);
+    if (result == NULL) exit(1);
+    return result;
+  }
+
+  // 同一个尺寸类内的增减不需要移动
+  if (oldSize <= POOL_MAX_SIZE && newSize <= POOL_MAX_SIZE &&
+      sizeClassOf(oldSize) == sizeClassOf(newSize)) {
+    return pointer;
+  }
+
+  void* result = poolAllocate(newSize);
+  memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+  poolFree(pointer, oldSize);
+  return result;
+}
+
+void* poolAllocateObject(size_t size) {
+  if (size > POOL_MAX_SIZE) {
+    LargeObject* large = (LargeObject*)malloc(sizeof(LargeObject) + size);
+    if (large == NULL) exit(1);
+
+    large->size = size;
+    large->isMarked = false;
+    large->prev = NULL;
+    large->next = largeObjects;
+    if (largeObjects != NULL) largeObjects->prev = large;
+    largeObjects = large;
+    return large + 1;
+  }
+
+  int sizeClass = sizeClassOf(size);
+  void* object = allocateBlock(&objectClasses[sizeClass], sizeClass, &objectPages);
+
+  PoolPage* page = poolPageOf(object);
+  int bit = poolBitOf(page, object);
+  // 空闲块的标记位总是 0：清除时只释放没有标记的对象
+  page->live[bit / 64] |= (uint64_t)1 << (bit % 64);
+  if (page->needsSweep) poolSetMarked(object);
+  return object;
+}
+
+void poolFreeObject(void* pointer, size_t size) {
+  if (size > POOL_MAX_SIZE) {
+    LargeObject* large = poolLargeOf(pointer);
+    if (large->prev != NULL) {
+      large->prev->next = large->next;
+    } else {
+      largeObjects = large->next;
+    }
+    if (large->next != NULL) large->next->prev = large->prev;
+    free(large);
+    return;
+  }
+
+  PoolPage* page = poolPageOf(pointer);
+  int bit = poolBitOf(page, pointer);
+  page->live[bit / 64] &= ~((uint64_t)1 << (bit % 64));
+
+  int sizeClass = sizeClassOf(size);
+  if (freeCache != NULL) {
+    cacheBlock(&freeCache->objects[sizeClass], sizeClass, pointer);
+    return;
+  }
+  freeBlock(&objectClasses[sizeClass], sizeClass, pointer);
+}
+
+PoolPage* poolObjectPages() {
+  return objectPages;
+}
+
+LargeObject* poolLargeObjects() {
+  return largeObjects;
+}
+
+void poolClearMarks() {
+  for (PoolPage* page = objectPages; page != NULL; page = page->next) {
+    memset(page->marks, 0, sizeof(page->marks));
+  }
+  for (LargeObject* large = largeObjects; large != NULL; large = large->next) {
+    large->isMarked = false;
+  }
+}
+
+int poolBeginLazySweep() {
+  int count = 0;
+  for (PoolPage* page = objectPages; page != NULL; page = page->next) {
+    page->needsSweep = true;
+    count++;
+  }
+  for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+    objectClasses[i].unswept = objectClasses[i].pages;
+  }
+  return count;
+}
+
+PoolPage* poolNextUnsweptPage(size_t size) {
+  PoolClass* poolClass = &objectClasses[sizeClassOf(size)];
+  if (poolClass->freeList != NULL) return NULL;
+
+  // 跳过已经清除过的页
+  while (poolClass->unswept != NULL && !poolClass->unswept->needsSweep) {
+    poolClass->unswept = poolClass->unswept->classNext;
+  }
+
+  PoolPage* page = poolClass->unswept;
+  if (page == NULL) return NULL;
+  poolClass->unswept = page->classNext;
+  page->needsSweep = false;
+  return page;
+}
+
+void poolUseFreeCache(PoolFreeCache* cache) {
+  freeCache = cache;
+}
+
+void poolMergeFreeCache(PoolFreeCache* cache) {
+  for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+    mergeFreeList(&classes[i], &cache->raw[i], i);
+    mergeFreeList(&objectClasses[i], &cache->objects[i], i);
+  }
+}
+
+/**
+ * @brief 释放页链表中所有的页
+ */
+static void freePages(PoolPage* page) {
+  while (page != NULL) {
+    PoolPage* next = page->next;
+    UNPOISON(page, POOL_PAGE_SIZE);
+    free(page);
+    page = next;
+  }
+}
+
+/**
+ * @brief 重置所有尺寸类的分配状态
+ */
+static void resetClasses(PoolClass* poolClasses) {
+  for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+    poolClasses[i].freeList = NULL;
+    poolClasses[i].bump = NULL;
+    poolClasses[i].end = NULL;
+    poolClasses[i].pages = NULL;
+    poolClasses[i].unswept = NULL;
+  }
+}
+
+void freePool() {
+  freePages(pages);
+  freePages(objectPages);
+  pages = NULL;
+  objectPages = NULL;
+  resetClasses(classes);
+  resetClasses(objectClasses);
+
+  // 正常情况下大对象已经在 freeObjects 中逐个释放
+  while (largeObjects != NULL) {
+    LargeObject* next = largeObjects->next;
+    free(largeObjects);
+    largeObjects = next;
+  }
+}
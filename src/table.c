@@ -6,19 +6,419 @@
 #include "table.h"
 #include "value.h"
 
+#if defined(SWISS_TABLE) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define TABLE_MAX_LOAD 0.75
+// 删除条目之后存活条目低于这个比例时缩小容量
+#define TABLE_MIN_LOAD 0.25
+
+#ifdef SWISS_TABLE
+// 一组槽位的数量，容量总是它的整数倍
+#define GROUP_WIDTH 16
+#define TABLE_MIN_CAPACITY GROUP_WIDTH
+// 控制字节：最高位为 1 表示没有 key，否则低 7 位是 key 哈希值的低 7 位
+#define CONTROL_EMPTY ((uint8_t)0x80)
+#define CONTROL_DELETED ((uint8_t)0xFE)
+
+// 每个槽位占用的内存：一个 Entry 加一个控制字节
+#define TABLE_SLOT_SIZE (sizeof(Entry) + 1)
+#else
+#define TABLE_MIN_CAPACITY 8
+#endif
+
+static void reserveEntry(Table* table);
+static void compactTable(Table* table);
 
 void initTable(Table* table) {
   table->count = 0;
+  table->tombstones = 0;
   table->capacity = 0;
   table->entries = NULL;
+#ifdef SWISS_TABLE
+  table->control = NULL;
+#endif
 }
 
 void freeTable(Table* table) {
-  FREE_ARRAY(Entry, table->entries, table->capacity);
+  // 小表没有单独分配内存，entries 的位置上是内联的条目
+  if (table->capacity > 0) {
+#ifdef SWISS_TABLE
+    FREE_ARRAY(char, table->entries, table->capacity * TABLE_SLOT_SIZE);
+#else
+    FREE_ARRAY(Entry, table->entries, table->capacity);
+#endif
+  }
   initTable(table);
 }
 
+#ifdef SMALL_TABLE
+/**
+ * @brief 小表按指针逐个比较 key，找不到时返回 -1
+ */
+static inline int findSmall(Table* table, ObjString* key) {
+  for (int i = 0; i < table->count; i++) {
+    if (table->smallKeys[i] == key) return i;
+  }
+  return -1;
+}
+
+/**
+ * @brief 删除小表中的一个条目，用最后一个条目填补空位，小表不留墓碑
+ */
+static void removeSmall(Table* table, int index) {
+  table->count--;
+  table->smallKeys[index] = table->smallKeys[table->count];
+  table->smallValues[index] = table->smallValues[table->count];
+}
+
+/**
+ * @brief 
+ * 切换到哈希表之前，把小表的条目取出到 entries 中，返回条目数；
+ * 内联数组和 entries 指针共用内存，取出之后把指针清空
+ * 
+ * @param table 小表
+ * @param entries 至少 TABLE_SMALL_CAPACITY 个条目
+ */
+static int takeSmallEntries(Table* table, Entry* entries) {
+  int count = table->count;
+  for (int i = 0; i < count; i++) {
+    entries[i].key = table->smallKeys[i];
+    entries[i].value = table->smallValues[i];
+  }
+  table->entries = NULL;
+#ifdef SWISS_TABLE
+  table->control = NULL;
+#endif
+  return count;
+}
+
+/**
+ * @brief 存活条目很少时释放哈希表的内存，把条目搬回内联数组
+ */
+static void moveToSmall(Table* table) {
+  Entry small[TABLE_SMALL_CAPACITY];
+  int count = 0;
+  for (int i = 0; i < table->capacity; i++) {
+    if (table->entries[i].key != NULL) small[count++] = table->entries[i];
+  }
+
+  freeTable(table);
+  for (int i = 0; i < count; i++) {
+    table->smallKeys[i] = small[i].key;
+    table->smallValues[i] = small[i].value;
+  }
+  table->count = count;
+}
+#endif
+
+#ifdef SWISS_TABLE
+/**
+ * @brief 一组控制字节的匹配结果，第 i 位对应组内第 i 个槽位
+ */
+typedef uint32_t GroupMask;
+
+/**
+ * @brief 哈希值的低 7 位存入控制字节，用剩下的位选择从哪一组开始探测
+ */
+static inline uint8_t hashTag(uint32_t hash) {
+  return (uint8_t)(hash & 0x7F);
+}
+
+static inline uint32_t hashGroup(uint32_t hash) {
+  return hash >> 7;
+}
+
+/**
+ * @brief 组内控制字节等于 tag 的槽位
+ */
+static inline GroupMask matchTag(const uint8_t* group, uint8_t tag) {
+#ifdef __SSE2__
+  __m128i control = _mm_loadu_si128((const __m128i*)group);
+  return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8((char)tag)));
+#else
+  GroupMask mask = 0;
+  for (int i = 0; i < GROUP_WIDTH; i++) {
+    if (group[i] == tag) mask |= (GroupMask)1 << i;
+  }
+  return mask;
+#endif
+}
+
+/**
+ * @brief 组内没有使用过的槽位，探测到这样的组就可以停止
+ */
+static inline GroupMask matchEmpty(const uint8_t* group) {
+  return matchTag(group, CONTROL_EMPTY);
+}
+
+/**
+ * @brief 组内可以插入新 key 的槽位，即空槽位和墓碑
+ */
+static inline GroupMask matchFree(const uint8_t* group) {
+#ifdef __SSE2__
+  // 只有这两种控制字节的最高位是 1
+  return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+  GroupMask mask = 0;
+  for (int i = 0; i < GROUP_WIDTH; i++) {
+    if (group[i] & 0x80) mask |= (GroupMask)1 << i;
+  }
+  return mask;
+#endif
+}
+
+/**
+ * @brief 匹配结果中第一个槽位在组内的下标，mask 不能为 0
+ */
+static inline int firstSlot(GroupMask mask) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctz(mask);
+#else
+  int slot = 0;
+  while ((mask & 1) == 0) {
+    mask >>= 1;
+    slot++;
+  }
+  return slot;
+#endif
+}
+
+/**
+ * @brief 
+ * 按组探测 key：先用控制字节在一组 16 个槽位中筛出哈希片段相同的槽位，再比较 key 指针；
+ * 找到 key 时返回它所在的槽位，否则返回探测路径上第一个空槽位或墓碑，
+ * 和线性探测一样优先复用墓碑。
+ * 组之间按 1, 2, 3... 的步长跳跃，组数是 2 的幂时可以遍历所有的组；
+ * 负载因子保证一定存在空槽位，循环总会结束
+ * 
+ * @param entries HashTable 内存储的 KV 对数组
+ * @param control 控制字节数组
+ * @param capacity HashTable 容量
+ * @param key 需要查找的 key
+ * @return int 槽位下标
+ */
+static int findEntry(Entry* entries, uint8_t* control, int capacity, ObjString* key) {
+  uint32_t groupMask = (uint32_t)(capacity / GROUP_WIDTH - 1);
+  uint32_t group = hashGroup(key->hash) & groupMask;
+  uint8_t tag = hashTag(key->hash);
+  int insert = -1;
+
+  for (uint32_t step = 1;; step++) {
+    uint8_t* groupControl = &control[group * GROUP_WIDTH];
+    for (GroupMask match = matchTag(groupControl, tag); match != 0; match &= match - 1) {
+      int index = (int)group * GROUP_WIDTH + firstSlot(match);
+      if (entries[index].key == key) return index;
+    }
+
+    if (insert == -1) {
+      GroupMask free = matchFree(groupControl);
+      if (free != 0) insert = (int)group * GROUP_WIDTH + firstSlot(free);
+    }
+    if (matchEmpty(groupControl) != 0) return insert;
+
+    group = (group + step) & groupMask;
+  }
+}
+
+/**
+ * @brief 探测路径上第一个空槽位或墓碑，用于插入已知不在表中的 key
+ */
+static int findFree(uint8_t* control, int capacity, uint32_t hash) {
+  uint32_t groupMask = (uint32_t)(capacity / GROUP_WIDTH - 1);
+  uint32_t group = hashGroup(hash) & groupMask;
+
+  for (uint32_t step = 1;; step++) {
+    GroupMask free = matchFree(&control[group * GROUP_WIDTH]);
+    if (free != 0) return (int)group * GROUP_WIDTH + firstSlot(free);
+
+    group = (group + step) & groupMask;
+  }
+}
+
+/**
+ * @brief 只查找 key，不需要插入位置时使用，找不到时返回 -1
+ */
+static int findKey(Table* table, ObjString* key) {
+  uint32_t groupMask = (uint32_t)(table->capacity / GROUP_WIDTH - 1);
+  uint32_t group = hashGroup(key->hash) & groupMask;
+  uint8_t tag = hashTag(key->hash);
+
+  for (uint32_t step = 1;; step++) {
+    uint8_t* groupControl = &table->control[group * GROUP_WIDTH];
+    for (GroupMask match = matchTag(groupControl, tag); match != 0; match &= match - 1) {
+      int index = (int)group * GROUP_WIDTH + firstSlot(match);
+      if (table->entries[index].key == key) return index;
+    }
+    if (matchEmpty(groupControl) != 0) return -1;
+
+    group = (group + step) & groupMask;
+  }
+}
+
+/**
+ * @brief 
+ * 按照新的容量重新分配哈希表的 Entry 数组和控制字节，
+ * 并将老数据迁移过去，墓碑在迁移时丢弃
+ * 
+ * @param table 哈希表指针
+ * @param capacity 新的容量，GROUP_WIDTH 的整数倍并且组数是 2 的幂
+ */
+static void adjustCapacity(Table* table, int capacity) {
+  Entry* entries = (Entry*)ALLOCATE(char, capacity * TABLE_SLOT_SIZE);
+  uint8_t* control = (uint8_t*)(entries + capacity);
+  for (int i = 0; i < capacity; i++) {
+    entries[i].key = NULL;
+    entries[i].value = NIL_VAL;
+  }
+  memset(control, CONTROL_EMPTY, capacity);
+
+  Entry* oldEntries = table->entries;
+  int oldCapacity = table->capacity;
+#ifdef SMALL_TABLE
+  Entry small[TABLE_SMALL_CAPACITY];
+  if (oldCapacity == 0) {
+    oldCapacity = takeSmallEntries(table, small);
+    oldEntries = small;
+  }
+#endif
+
+  table->count = 0;
+  for (int i = 0; i < oldCapacity; i++) {
+    Entry* entry = &oldEntries[i];
+    if (entry->key == NULL) continue;
+
+    int index = findFree(control, capacity, entry->key->hash);
+    entries[index] = *entry;
+    control[index] = hashTag(entry->key->hash);
+    table->count++;
+  }
+
+  FREE_ARRAY(char, table->entries, table->capacity * TABLE_SLOT_SIZE);
+  table->entries = entries;
+  table->control = control;
+  table->capacity = capacity;
+  table->tombstones = 0;
+}
+
+/**
+ * @brief 
+ * 不改变容量，原地重新散列以清除所有墓碑，不需要分配内存：
+ * 先把墓碑变成空槽位、把存活条目的控制字节改成 CONTROL_DELETED 表示还没有安置，
+ * 再逐个为没有安置的条目找到探测路径上第一个空闲的槽位：
+ * 和当前槽位在同一组时原地不动；目标是空槽位时搬过去；
+ * 目标是另一个还没有安置的条目时两者交换，再处理换过来的条目
+ * 
+ * @param table 
+ */
+static void rehashTable(Table* table) {
+  Entry* entries = table->entries;
+  uint8_t* control = table->control;
+  for (int i = 0; i < table->capacity; i++) {
+    control[i] = (control[i] & 0x80) ? CONTROL_EMPTY : CONTROL_DELETED;
+  }
+
+  for (int i = 0; i < table->capacity; i++) {
+    if (control[i] != CONTROL_DELETED) continue;
+
+    uint32_t hash = entries[i].key->hash;
+    int target = findFree(control, table->capacity, hash);
+    if (target / GROUP_WIDTH == i / GROUP_WIDTH) {
+      control[i] = hashTag(hash);
+    } else if (control[target] == CONTROL_EMPTY) {
+      entries[target] = entries[i];
+      control[target] = hashTag(hash);
+      entries[i].key = NULL;
+      entries[i].value = NIL_VAL;
+      control[i] = CONTROL_EMPTY;
+    } else {
+      Entry entry = entries[target];
+      entries[target] = entries[i];
+      control[target] = hashTag(hash);
+      entries[i] = entry;
+      i--;
+    }
+  }
+
+  table->count -= table->tombstones;
+  table->tombstones = 0;
+}
+
+/**
+ * @brief 把槽位上的条目换成墓碑，之后的探测会越过它继续查找
+ */
+static void removeEntry(Table* table, int index) {
+  table->entries[index].key = NULL;
+  table->entries[index].value = NIL_VAL;
+  table->control[index] = CONTROL_DELETED;
+  table->tombstones++;
+}
+
+static bool hashGet(Table* table, ObjString* key, Value* value) {
+  if (table->count == 0) return false;
+
+  int index = findKey(table, key);
+  if (index == -1) return false;
+
+  *value = table->entries[index].value;
+  return true;
+}
+
+static bool hashSet(Table* table, ObjString* key, Value value) {
+  reserveEntry(table);
+
+  int index = findEntry(table->entries, table->control, table->capacity, key);
+  Entry* entry = &table->entries[index];
+  bool isNewKey = entry->key == NULL;
+  // 覆盖墓碑条目时，不增加条目计数
+  if (isNewKey) {
+    if (table->control[index] == CONTROL_EMPTY) {
+      table->count++;
+    } else {
+      table->tombstones--;
+    }
+  }
+
+  entry->key = key;
+  entry->value = value;
+  table->control[index] = hashTag(key->hash);
+  return isNewKey;
+}
+
+static bool hashDelete(Table* table, ObjString* key) {
+  if (table->count == 0) return false;
+
+  int index = findKey(table, key);
+  if (index == -1) return false;
+
+  removeEntry(table, index);
+  compactTable(table);
+  return true;
+}
+
+static ObjString* hashFindString(Table* table, const char* chars, int length, uint32_t hash) {
+  if (table->count == 0) return NULL;
+
+  uint32_t groupMask = (uint32_t)(table->capacity / GROUP_WIDTH - 1);
+  uint32_t group = hashGroup(hash) & groupMask;
+  uint8_t tag = hashTag(hash);
+
+  for (uint32_t step = 1;; step++) {
+    uint8_t* groupControl = &table->control[group * GROUP_WIDTH];
+    for (GroupMask match = matchTag(groupControl, tag); match != 0; match &= match - 1) {
+      ObjString* key = table->entries[group * GROUP_WIDTH + firstSlot(match)].key;
+      if (key->length == length && key->hash == hash &&
+          memcmp(key->chars, chars, length) == 0) {
+        return key;
+      }
+    }
+    if (matchEmpty(groupControl) != 0) return NULL;
+
+    group = (group + step) & groupMask;
+  }
+}
+#else
 /**
  * @brief 
  * 根据 Key 找到哈希表的指定行数，方法是按哈希表的容量取模，
@@ -69,10 +469,20 @@ static void adjustCapacity(Table* table, int capacity) {
     entries[i].value = NIL_VAL;
   }
 
+  Entry* oldEntries = table->entries;
+  int oldCapacity = table->capacity;
+#ifdef SMALL_TABLE
+  Entry small[TABLE_SMALL_CAPACITY];
+  if (oldCapacity == 0) {
+    oldCapacity = takeSmallEntries(table, small);
+    oldEntries = small;
+  }
+#endif
+
   // 重建索引时，为了不统计墓碑，这里重新对条目数量计数
   table->count = 0;
-  for (int i = 0; i < table->capacity; i++) {
-    Entry* entry = &table->entries[i];
+  for (int i = 0; i < oldCapacity; i++) {
+    Entry* entry = &oldEntries[i];
     if (entry->key == NULL) continue;
 
     Entry* dest = findEntry(entries, capacity, entry->key);
@@ -84,9 +494,27 @@ static void adjustCapacity(Table* table, int capacity) {
   FREE_ARRAY(Entry, table->entries, table->capacity);
   table->entries = entries;
   table->capacity = capacity;
+  table->tombstones = 0;
 }
 
-bool tableGet(Table* table, ObjString* key, Value* value) {
+/**
+ * @brief 线性探测时墓碑可能挡在条目前面，按原来的容量重建一次来清除墓碑
+ */
+static void rehashTable(Table* table) {
+  adjustCapacity(table, table->capacity);
+}
+
+/**
+ * @brief 把条目换成墓碑：key 为 NULL，value 为 true
+ */
+static void removeEntry(Table* table, int index) {
+  Entry* entry = &table->entries[index];
+  entry->key = NULL;
+  entry->value = BOOL_VAL(true);
+  table->tombstones++;
+}
+
+static bool hashGet(Table* table, ObjString* key, Value* value) {
   if (table->count == 0) return false;
 
   Entry* entry = findEntry(table->entries, table->capacity, key);
@@ -96,46 +524,38 @@ bool tableGet(Table* table, ObjString* key, Value* value) {
   return true;
 }
 
-bool tableSet(Table* table, ObjString* key, Value value) {
-  // 达到容量限制时，对 Entry 数组容量进行扩展，并将老数据迁移到新数组中
-  if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-    int capacity = GROW_CAPACITY(table->capacity);
-    adjustCapacity(table, capacity);
-  }
+static bool hashSet(Table* table, ObjString* key, Value value) {
+  reserveEntry(table);
 
   Entry* entry = findEntry(table->entries, table->capacity, key);
   bool isNewKey = entry->key == NULL;
   // 覆盖墓碑条目时，不增加条目计数
-  if (isNewKey && IS_NIL(entry->value)) table->count++;
+  if (isNewKey) {
+    if (IS_NIL(entry->value)) {
+      table->count++;
+    } else {
+      table->tombstones--;
+    }
+  }
 
   entry->key = key;
   entry->value = value;
   return isNewKey;
 }
 
-bool tableDelete(Table* table, ObjString* key) {
+static bool hashDelete(Table* table, ObjString* key) {
   if (table->count == 0) return false;
 
   // 尝试找到这一条
   Entry* entry = findEntry(table->entries, table->capacity, key);
   if (entry->key == NULL) return false;
 
-  // 放置一个特殊值在这里
-  entry->key = NULL;
-  entry->value = BOOL_VAL(true);
+  removeEntry(table, (int)(entry - table->entries));
+  compactTable(table);
   return true;
 }
 
-void tableAddAll(Table* from, Table* to) {
-  for (int i = 0; i < from->capacity; i++) {
-    Entry* entry = &from->entries[i];
-    if (entry->key != NULL) {
-      tableSet(to, entry->key, entry->value);
-    }
-  }
-}
-
-ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
+static ObjString* hashFindString(Table* table, const char* chars, int length, uint32_t hash) {
   if (table->count == 0) return NULL;
 
   uint32_t index = hash & (table->capacity - 1);
@@ -154,17 +574,176 @@ ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t
     index = (index + 1) & (table->capacity - 1);
   }
 }
+#endif
+
+/**
+ * @brief 能在不超过一半最大负载的情况下放下 live 个条目的最小容量
+ */
+static int capacityFor(int live) {
+  int capacity = TABLE_MIN_CAPACITY;
+  while (live > capacity * TABLE_MAX_LOAD / 2) capacity *= 2;
+  return capacity;
+}
+
+/**
+ * @brief 
+ * 插入一个新条目之前调用，保证插入之后负载不超过 TABLE_MAX_LOAD：
+ * 负载主要来自墓碑、存活条目不到一半时原地重新散列，否则扩容
+ * 
+ * @param table 
+ */
+static void reserveEntry(Table* table) {
+  if (table->count + 1 <= table->capacity * TABLE_MAX_LOAD) return;
+
+  int live = table->count - table->tombstones;
+  if (table->tombstones > 0 && live + 1 <= table->capacity * TABLE_MAX_LOAD / 2) {
+    rehashTable(table);
+  } else {
+    int capacity = table->capacity < TABLE_MIN_CAPACITY ? TABLE_MIN_CAPACITY : table->capacity * 2;
+    adjustCapacity(table, capacity);
+  }
+}
+
+/**
+ * @brief 
+ * 删除条目之后调用：表空了就释放内存，开启 SMALL_TABLE 时条目很少就退回小表，
+ * 存活条目低于 TABLE_MIN_LOAD 时缩小容量，
+ * 墓碑比存活条目还多时原地重新散列，避免查找越过大量墓碑
+ * 
+ * @param table 
+ */
+static void compactTable(Table* table) {
+  int live = table->count - table->tombstones;
+  if (live == 0) {
+    freeTable(table);
+#ifdef SMALL_TABLE
+  } else if (live <= TABLE_SMALL_CAPACITY / 2) {
+    moveToSmall(table);
+#endif
+  } else if (table->capacity > TABLE_MIN_CAPACITY && live < table->capacity * TABLE_MIN_LOAD) {
+    adjustCapacity(table, capacityFor(live));
+  } else if (table->tombstones > live) {
+    rehashTable(table);
+  }
+}
+
+bool tableGet(Table* table, ObjString* key, Value* value) {
+#ifdef SMALL_TABLE
+  if (table->capacity == 0) {
+    int index = findSmall(table, key);
+    if (index == -1) return false;
+
+    *value = table->smallValues[index];
+    return true;
+  }
+#endif
+  return hashGet(table, key, value);
+}
+
+bool tableSet(Table* table, ObjString* key, Value value) {
+#ifdef SMALL_TABLE
+  if (table->capacity == 0) {
+    int index = findSmall(table, key);
+    if (index != -1) {
+      table->smallValues[index] = value;
+      return false;
+    }
+    if (table->count < TABLE_SMALL_CAPACITY) {
+      table->smallKeys[table->count] = key;
+      table->smallValues[table->count] = value;
+      table->count++;
+      return true;
+    }
+
+    // 内联数组已满，切换到哈希表
+    adjustCapacity(table, capacityFor(table->count + 1));
+  }
+#endif
+  return hashSet(table, key, value);
+}
+
+bool tableDelete(Table* table, ObjString* key) {
+#ifdef SMALL_TABLE
+  if (table->capacity == 0) {
+    int index = findSmall(table, key);
+    if (index == -1) return false;
+
+    removeSmall(table, index);
+    return true;
+  }
+#endif
+  return hashDelete(table, key);
+}
+
+ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
+#ifdef SMALL_TABLE
+  if (table->capacity == 0) {
+    for (int i = 0; i < table->count; i++) {
+      ObjString* key = table->smallKeys[i];
+      if (key->length == length && key->hash == hash &&
+          memcmp(key->chars, chars, length) == 0) {
+        return key;
+      }
+    }
+    return NULL;
+  }
+#endif
+  return hashFindString(table, chars, length, hash);
+}
+
+void tableAddAll(Table* from, Table* to) {
+#ifdef SMALL_TABLE
+  if (from->capacity == 0) {
+    for (int i = 0; i < from->count; i++) {
+      tableSet(to, from->smallKeys[i], from->smallValues[i]);
+    }
+    return;
+  }
+#endif
+  for (int i = 0; i < from->capacity; i++) {
+    Entry* entry = &from->entries[i];
+    if (entry->key != NULL) {
+      tableSet(to, entry->key, entry->value);
+    }
+  }
+}
 
 void tableRemoveWhite(Table* table) {
+#ifdef SMALL_TABLE
+  if (table->capacity == 0) {
+    for (int i = 0; i < table->count; i++) {
+      if (!isMarked(&table->smallKeys[i]->obj)) {
+        // 最后一个条目换到了这里，需要再检查一次
+        removeSmall(table, i);
+        i--;
+      }
+    }
+    return;
+  }
+#endif
+
+  int removed = 0;
   for (int i = 0; i < table->capacity; i++) {
     Entry* entry = &table->entries[i];
-    if (entry->key != NULL && !entry->key->obj.isMarked) {
-      tableDelete(table, entry->key);
+    if (entry->key != NULL && !isMarked(&entry->key->obj)) {
+      removeEntry(table, i);
+      removed++;
     }
   }
+  // 遍历结束之后再整理，整理会移动条目
+  if (removed > 0) compactTable(table);
 }
 
 void markTable(Table* table) {
+#ifdef SMALL_TABLE
+  if (table->capacity == 0) {
+    for (int i = 0; i < table->count; i++) {
+      markObject((Obj*)table->smallKeys[i]);
+      markValue(table->smallValues[i]);
+    }
+    return;
+  }
+#endif
   for (int i = 0; i < table->capacity; i++) {
     Entry* entry = &table->entries[i];
     markObject((Obj*)entry->key);
@@ -44,19 +44,28 @@ void printValue(Value value) {
       printf(AS_BOOL(value) ? "true" : "false");
       break;
     case VAL_NIL: printf("nil"); break;
-    case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
+    case VAL_NUMBER:
+    case VAL_INT: printf("%g", AS_NUMBER(value)); break;
     case VAL_OBJ: printObject(value); break;
   }
 #endif
 }
 
 bool valuesEqual(Value a, Value b) {
+  // 拼接出来的字符串不进入驻留表，内容相同的字符串可能是不同的对象
+  if (IS_STRING(a) && IS_STRING(b)) {
+    return stringsEqual(AS_STRING(a), AS_STRING(b));
+  }
 #ifdef NAN_BOXING
   if (IS_NUMBER(a) && IS_NUMBER(b)) {
     return AS_NUMBER(a) == AS_NUMBER(b);
   }
   return a == b;
 #else
+  // 小整数和 double 按数值比较
+  if (IS_NUMBER(a) && IS_NUMBER(b)) {
+    return AS_NUMBER(a) == AS_NUMBER(b);
+  }
   if (a.type != b.type) return false;
   switch (a.type) {
     case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
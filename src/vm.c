@@ -16,6 +16,189 @@ static Value clockNative(int argCount, Value* args) {
   return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
 }
 
+/**
+ * @brief 给 native 创建的实例添加一个字段，value 必须已经被 GC 可达
+ */
+static void addNativeField(ObjInstance* instance, const char* name, Value value) {
+  push(OBJ_VAL(copyString(name, (int)strlen(name))));
+  ObjShape* shape = shapeAddField(instance->shape, AS_STRING(vm.stackTop[-1]));
+  instanceAddField(instance, shape, value);
+  pop();
+}
+
+/**
+ * @brief 新建一个名为 name 的类的空实例，压入栈中防止被回收
+ */
+static ObjInstance* pushNativeInstance(const char* name) {
+  push(OBJ_VAL(copyString(name, (int)strlen(name))));
+  ObjClass* klass = newClass(AS_STRING(vm.stackTop[-1]));
+  vm.stackTop[-1] = OBJ_VAL(klass);
+  ObjInstance* instance = newInstance(klass);
+  vm.stackTop[-1] = OBJ_VAL(instance);
+  return instance;
+}
+
+/**
+ * @brief 
+ * gcStats() 返回调用时 GC 统计数据的快照，时间的单位是毫秒，
+ * 各类型存活的对象数在 live 字段中，例如 gcStats().live.strings
+ */
+static Value gcStatsNative(int argCount, Value* args) {
+  GCStats stats;
+  readGCStats(&stats);
+
+  ObjInstance* result = pushNativeInstance("GCStats");
+  addNativeField(result, "youngCollections", NUMBER_VAL(stats.youngCollections));
+  addNativeField(result, "fullCollections", NUMBER_VAL(stats.fullCollections));
+  addNativeField(result, "pauses", NUMBER_VAL(stats.pauseCount));
+  addNativeField(result, "pauseTotal", NUMBER_VAL(stats.pauseTotal / 1e6));
+  addNativeField(result, "pauseWorst", NUMBER_VAL(stats.pauseWorst / 1e6));
+  addNativeField(result, "markTime", NUMBER_VAL(stats.markTime / 1e6));
+  addNativeField(result, "sweepTime", NUMBER_VAL(stats.sweepTime / 1e6));
+  addNativeField(result, "concurrentMarkTime", NUMBER_VAL(stats.concurrentMarkTime / 1e6));
+  addNativeField(result, "bytesAllocated", NUMBER_VAL((double)stats.totalAllocated));
+  addNativeField(result, "bytesFreed", NUMBER_VAL((double)stats.totalFreed));
+  addNativeField(result, "heapSize",
+                 NUMBER_VAL((double)(stats.totalAllocated - stats.totalFreed)));
+
+  ObjInstance* live = pushNativeInstance("GCLiveObjects");
+  for (int type = 0; type < OBJ_TYPE_COUNT; type++) {
+    addNativeField(live, objTypeName((ObjType)type), NUMBER_VAL(stats.liveObjects[type]));
+  }
+  addNativeField(result, "live", OBJ_VAL(live));
+  pop();
+
+  pop();
+  return OBJ_VAL(result);
+}
+
+/**
+ * @brief 
+ * gcPauseHistogram(i) 返回停顿直方图第 i 个桶的停顿次数，
+ * 即 [2^i, 2^(i+1)) 微秒的停顿；i 超出范围时返回 nil
+ */
+static Value gcPauseHistogramNative(int argCount, Value* args) {
+  if (argCount != 1 || !IS_NUMBER(args[0])) return NIL_VAL;
+  double bucket = AS_NUMBER(args[0]);
+  if (bucket < 0 || bucket >= GC_PAUSE_BUCKETS || bucket != (int)bucket) return NIL_VAL;
+
+  GCStats stats;
+  readGCStats(&stats);
+  return NUMBER_VAL(stats.pauseHistogram[(int)bucket]);
+}
+
+/**
+ * @brief 读取一个作为下标的参数，必须是 [0, limit] 之间的整数
+ */
+static bool indexArgument(Value value, int limit, int* index) {
+  if (!IS_NUMBER(value)) return false;
+  double number = AS_NUMBER(value);
+  if (!(number >= 0 && number <= limit) || number != (int)number) return false;
+  *index = (int)number;
+  return true;
+}
+
+/**
+ * @brief 
+ * substring(s, start, end) 返回 s 中 [start, end) 的字符，省略 end 时到结尾为止；
+ * 较长的结果是引用 s 的切片，见 sliceString。参数不合法时返回 nil
+ */
+static Value substringNative(int argCount, Value* args) {
+  if ((argCount != 2 && argCount != 3) || !IS_STRING(args[0])) return NIL_VAL;
+  ObjString* string = AS_STRING(args[0]);
+  int start;
+  int end = string->length;
+  if (!indexArgument(args[1], string->length, &start)) return NIL_VAL;
+  if (argCount == 3 && !indexArgument(args[2], string->length, &end)) return NIL_VAL;
+  if (end < start) return NIL_VAL;
+  return OBJ_VAL(sliceString(string, start, end - start));
+}
+
+/**
+ * @brief 在 haystack 中查找 needle 第一次出现的位置，没有找到时返回 -1
+ */
+static int findChars(const char* haystack, int length, const char* needle, int needleLength) {
+  for (int i = 0; i + needleLength <= length; i++) {
+    const char* first = memchr(haystack + i, needle[0], length - needleLength - i + 1);
+    if (first == NULL) return -1;
+    i = (int)(first - haystack);
+    if (memcmp(first, needle, needleLength) == 0) return i;
+  }
+  return -1;
+}
+
+/**
+ * @brief 把 s 用 separator 分隔之后的每一段依次追加到新的列表中，列表压入栈中防止被回收
+ */
+static Value splitAll(ObjString* string, ObjString* separator) {
+  ObjList* list = newList();
+  push(OBJ_VAL(list));
+  int start = 0;
+  for (;;) {
+    // 字符的位置不会变，但每次追加都可能触发 GC，所以每次重新读取
+    int found = findChars(stringChars(string) + start, string->length - start,
+                          stringChars(separator), separator->length);
+    int length = found < 0 ? string->length - start : found;
+    push(OBJ_VAL(sliceString(string, start, length)));
+    listAppend(list, vm.stackTop[-1]);
+    pop();
+    if (found < 0) break;
+    start += found + separator->length;
+  }
+  pop();
+  return OBJ_VAL(list);
+}
+
+/**
+ * @brief 
+ * split(s, separator, i) 返回用 separator 分隔 s 之后的第 i 段，从 0 开始，
+ * 超出段数时返回 nil；省略 i 时返回所有段组成的列表。
+ * 和 substring 一样，较长的结果是引用 s 的切片
+ */
+static Value splitNative(int argCount, Value* args) {
+  if ((argCount != 2 && argCount != 3) || !IS_STRING(args[0]) || !IS_STRING(args[1])) {
+    return NIL_VAL;
+  }
+  ObjString* string = AS_STRING(args[0]);
+  ObjString* separator = AS_STRING(args[1]);
+  if (separator->length == 0) return NIL_VAL;
+  if (argCount == 2) return splitAll(string, separator);
+  int field;
+  if (!indexArgument(args[2], INT32_MAX, &field)) return NIL_VAL;
+
+  // 两者都在栈上的参数中，展开 rope 时触发 GC 也不会回收，字符的位置也不会变
+  const char* chars = stringChars(string);
+  const char* sep = stringChars(separator);
+  int start = 0;
+  for (int i = 0; i < field; i++) {
+    int found = findChars(chars + start, string->length - start, sep, separator->length);
+    if (found < 0) return NIL_VAL;
+    start += found + separator->length;
+  }
+  int found = findChars(chars + start, string->length - start, sep, separator->length);
+  int length = found < 0 ? string->length - start : found;
+  return OBJ_VAL(sliceString(string, start, length));
+}
+
+/**
+ * @brief append(list, value) 在列表末尾追加 value，list 不是列表时返回 nil，否则返回 list
+ */
+static Value appendNative(int argCount, Value* args) {
+  if (argCount != 2 || !IS_LIST(args[0])) return NIL_VAL;
+  listAppend(AS_LIST(args[0]), args[1]);
+  return args[0];
+}
+
+/**
+ * @brief length(x) 返回列表的元素数或者字符串的长度，其他值返回 nil
+ */
+static Value lengthNative(int argCount, Value* args) {
+  if (argCount != 1) return NIL_VAL;
+  if (IS_LIST(args[0])) return NUMBER_VAL(AS_LIST(args[0])->items.count);
+  if (IS_STRING(args[0])) return NUMBER_VAL(AS_STRING(args[0])->length);
+  return NIL_VAL;
+}
+
 /**
  * @brief 初始化临时存放表达式值的栈
  */
@@ -50,38 +233,129 @@ static void runtimeError(const char* format, ...) {
   resetStack();
 }
 
+/**
+ * @brief 
+ * 分配时超过了堆的硬上限（vm.heapExhausted）就报运行时错误并清除标记；
+ * 报错的行号取自当前帧的 ip，调用前要写回状态
+ * 
+ * @return true 超过了上限，已经报错
+ */
+static bool heapLimitExceeded() {
+  if (!vm.heapExhausted) return false;
+  vm.heapExhausted = false;
+  runtimeError("Out of memory: heap limit of %zu bytes exceeded.", vm.gcConfig.heapLimit);
+  return true;
+}
+
+int resolveGlobal(ObjString* name) {
+  Value index;
+  if (tableGet(&vm.globalNames, name, &index)) {
+    return (int)AS_NUMBER(index);
+  }
+
+  push(OBJ_VAL(name));
+  if (vm.globalCapacity < vm.globalCount + 1) {
+    int oldCapacity = vm.globalCapacity;
+    vm.globalCapacity = GROW_CAPACITY(oldCapacity);
+    vm.globals = GROW_ARRAY(Global, vm.globals, oldCapacity, vm.globalCapacity);
+  }
+
+  Global* global = &vm.globals[vm.globalCount];
+  global->name = name;
+  global->value = NIL_VAL;
+  global->defined = false;
+  tableSet(&vm.globalNames, name, NUMBER_VAL(vm.globalCount));
+  pop();
+  return vm.globalCount++;
+}
+
 static void defineNative(const char* name, NativeFn function) {
-  push(OBJ_VAL(copyString(name, (int)strlen(name))));
+  int index = resolveGlobal(copyString(name, (int)strlen(name)));
   push(OBJ_VAL(newNative(function)));
-  tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
-  pop();
+  vm.globals[index].value = vm.stack[0];
+  vm.globals[index].defined = true;
   pop();
 }
 
+void initGCConfig(GCConfig* config) {
+  config->initialHeap = GC_INITIAL_HEAP;
+  config->growFactor = GC_HEAP_GROW_FACTOR;
+  config->minHeap = 0;
+  config->maxHeap = 0;
+  config->heapLimit = 0;
+}
+
+void configureGC(const GCConfig* config) {
+  vm.gcConfig = *config;
+  vm.nextGC = clampThreshold(config->initialHeap, vm.bytesAllocated);
+  vm.nextFullGC = vm.nextGC;
+}
+
 void initVM() {
   resetStack();
-  vm.objects = NULL;
+  vm.youngCount = 0;
+  vm.youngCapacity = 0;
+  vm.youngObjects = NULL;
   vm.bytesAllocated = 0;
-  vm.nextGC = 1024 * 1024;
+  initGCConfig(&vm.gcConfig);
+  vm.nextGC = vm.gcConfig.initialHeap;
+  vm.nextFullGC = vm.gcConfig.initialHeap;
+  vm.gcLiveBytes = 0;
+  vm.heapExhausted = false;
+
+  vm.rememberedCount = 0;
+  vm.rememberedCapacity = 0;
+  vm.rememberedSet = NULL;
+
+  vm.gcPhase = GC_PHASE_IDLE;
+  vm.gcRequested = false;
+  vm.gcRequestBytes = 0;
+  vm.gcEpoch = 0;
+  vm.sweepPage = NULL;
+  vm.sweepLarge = NULL;
+  vm.gcSliceBudget = GC_SLICE_BUDGET;
+  memset(&vm.gcStats, 0, sizeof(vm.gcStats));
+  vm.unsweptPages = 0;
+  vm.gcSweepWorkers = GC_SWEEP_WORKERS;
 
   vm.grayCount = 0;
   vm.grayCapacity = 0;
   vm.grayStack = NULL;
 
-  initTable(&vm.globals);
+  initTable(&vm.globalNames);
+  vm.globals = NULL;
+  vm.globalCount = 0;
+  vm.globalCapacity = 0;
   initTable(&vm.strings);
 
   vm.initString = NULL;
   vm.initString = copyString("init", 4);
   
   defineNative("clock", clockNative);
+  defineNative("gcStats", gcStatsNative);
+  defineNative("gcPauseHistogram", gcPauseHistogramNative);
+  defineNative("substring", substringNative);
+  defineNative("split", splitNative);
+  defineNative("append", appendNative);
+  defineNative("length", lengthNative);
 }
 
 void freeVM() {
-  freeTable(&vm.globals);
+#ifdef DEBUG_LOG_IC
+  printInlineCacheStats();
+#endif
+  freeTable(&vm.globalNames);
+  FREE_ARRAY(Global, vm.globals, vm.globalCapacity);
+  vm.globals = NULL;
+  vm.globalCount = 0;
+  vm.globalCapacity = 0;
   freeTable(&vm.strings);
   vm.initString = NULL;
   freeObjects();
+#ifdef DEBUG_LOG_GC_PAUSE
+  // freeObjects 之后后台标记线程已经退出，统计数据不会再变化
+  printGCPauseStats();
+#endif
 }
 
 /**
@@ -175,7 +449,8 @@ static bool callValue(Value callee, int argCount) {
         Value result = native(argCount, vm.stackTop - argCount);
         vm.stackTop -= argCount + 1;
         push(result);
-        return true;
+        // 本地函数里的分配没有经过 run() 的检查，在这里报错，行号就是调用的那一行
+        return !heapLimitExceeded();
       }
       default:
         break; // Non-callable object type.
@@ -194,7 +469,51 @@ static bool invokeFromClass(ObjClass* klass, ObjString* name, int argCount) {
   return call(AS_CLOSURE(method), argCount);
 }
 
-static bool invoke(ObjString* name, int argCount) {
+/**
+ * @brief 在调用点的内联缓存中查找接收者的 shape 对应的条目
+ * 
+ * @param cache 调用点的内联缓存
+ * @param shape 接收者的 shape
+ * @return InlineCacheEntry* 未找到时返回 NULL
+ */
+static inline InlineCacheEntry* findInlineCache(InlineCache* cache, ObjShape* shape) {
+  for (int i = 0; i < cache->count; i++) {
+    if (cache->entries[i].shape == shape) return &cache->entries[i];
+  }
+  return NULL;
+}
+
+/**
+ * @brief 未命中后更新内联缓存：同一个 shape 的条目直接覆盖，
+ * 条目已满时进入超态，不再记录新的 shape
+ * 
+ * @param cache 调用点的内联缓存
+ * @param shape 接收者的 shape
+ * @param transition 写入新字段后的 shape，其他情况传 NULL
+ * @param index 字段下标，缓存方法时传 -1
+ * @param method 缓存的方法，缓存字段时传 NULL
+ */
+static void updateInlineCache(InlineCache* cache, ObjShape* shape, ObjShape* transition,
+                              int index, ObjClosure* method) {
+  ObjFunction* function = vm.frames[vm.frameCount - 1].closure->function;
+  InlineCacheEntry* entry = findInlineCache(cache, shape);
+  if (entry == NULL) {
+    if (cache->count == INLINE_CACHE_ENTRIES) return;
+    preWriteBarrier((Obj*)function);
+    entry = &cache->entries[cache->count++];
+  } else {
+    preWriteBarrier((Obj*)function);
+  }
+
+  entry->shape = shape;
+  entry->transition = transition;
+  entry->index = index;
+  entry->method = method;
+  // 内联缓存属于当前正在执行的函数
+  writeBarrierObject((Obj*)function);
+}
+
+static bool invoke(InlineCache* cache, ObjString* name, int argCount) {
   Value receiver = peek(argCount);
   
   if (!IS_INSTANCE(receiver)) {
@@ -204,13 +523,89 @@ static bool invoke(ObjString* name, int argCount) {
 
   ObjInstance* instance = AS_INSTANCE(receiver);
 
-  Value value;
-  if (tableGet(&instance->fields, name, &value)) {
+  InlineCacheEntry* entry = findInlineCache(cache, instance->shape);
+  if (entry != NULL) {
+    cache->hits++;
+    if (entry->method != NULL) {
+      return call(entry->method, argCount);
+    }
+    Value value = instance->fields[entry->index];
     vm.stackTop[-argCount - 1] = value;
     return callValue(value, argCount);
   }
 
-  return invokeFromClass(instance->klass, name, argCount);
+  cache->misses++;
+  int index = shapeFieldIndex(instance->shape, name);
+  if (index != -1) {
+    updateInlineCache(cache, instance->shape, NULL, index, NULL);
+    Value value = instance->fields[index];
+    vm.stackTop[-argCount - 1] = value;
+    return callValue(value, argCount);
+  }
+
+  Value method;
+  if (!tableGet(&instance->klass->methods, name, &method)) {
+    runtimeError("Undefined property '%s'.", name->chars);
+    return false;
+  }
+  updateInlineCache(cache, instance->shape, NULL, -1, AS_CLOSURE(method));
+  return call(AS_CLOSURE(method), argCount);
+}
+
+/**
+ * @brief 内联缓存未命中时读取属性：先通过 shape 查实例字段，再查类的方法并绑定，
+ * 找到后把结果记录到内联缓存
+ * 
+ * @param cache 调用点的内联缓存
+ * @param instance 栈顶的实例
+ * @param name 属性名
+ * @return false 属性不存在
+ */
+static bool getProperty(InlineCache* cache, ObjInstance* instance, ObjString* name) {
+  int index = shapeFieldIndex(instance->shape, name);
+  if (index != -1) {
+    updateInlineCache(cache, instance->shape, NULL, index, NULL);
+    pop(); // Instance.
+    push(instance->fields[index]);
+    return true;
+  }
+
+  Value method;
+  if (!tableGet(&instance->klass->methods, name, &method)) {
+    runtimeError("Undefined property '%s'.", name->chars);
+    return false;
+  }
+  updateInlineCache(cache, instance->shape, NULL, -1, AS_CLOSURE(method));
+
+  ObjBoundMethod* bound = newBoundMethod(peek(0), AS_CLOSURE(method));
+  pop();
+  push(OBJ_VAL(bound));
+  return true;
+}
+
+/**
+ * @brief 内联缓存未命中时写入字段：已有字段直接写入下标，
+ * 新字段让实例迁移到新的 shape，并把结果记录到内联缓存
+ * 
+ * @param cache 调用点的内联缓存
+ * @param instance 被写入的实例
+ * @param name 字段名
+ * @param value 字段值
+ */
+static void setProperty(InlineCache* cache, ObjInstance* instance, ObjString* name, Value value) {
+  ObjShape* shape = instance->shape;
+  int index = shapeFieldIndex(shape, name);
+  if (index != -1) {
+    preWriteBarrier((Obj*)instance);
+    instance->fields[index] = value;
+    writeBarrier((Obj*)instance, value);
+    updateInlineCache(cache, shape, NULL, index, NULL);
+    return;
+  }
+
+  ObjShape* transition = shapeAddField(shape, name);
+  instanceAddField(instance, transition, value);
+  updateInlineCache(cache, shape, transition, transition->fieldCount - 1, NULL);
 }
 
 static bool bindMethod(ObjClass* klass, ObjString* name) {
@@ -271,8 +666,10 @@ static ObjUpvalue* captureUpvalue(Value* local) {
 static void closeUpvalues(Value* last) {
   while (vm.openUpvalues != NULL && vm.openUpvalues->location >= last) {
     ObjUpvalue* upvalue = vm.openUpvalues;
+    preWriteBarrier((Obj*)upvalue);
     upvalue->closed = *upvalue->location;
     upvalue->location = &upvalue->closed;
+    writeBarrier((Obj*)upvalue, upvalue->closed);
     vm.openUpvalues = upvalue->next;
   }
 }
@@ -280,7 +677,9 @@ static void closeUpvalues(Value* last) {
 static void defineMethod(ObjString* name) {
   Value method = peek(0);
   ObjClass* klass = AS_CLASS(peek(1));
+  preWriteBarrier((Obj*)klass);
   tableSet(&klass->methods, name, method);
+  writeBarrierObject((Obj*)klass);
   pop();
 }
 
@@ -295,302 +694,625 @@ static void concatenate() {
   ObjString* b = AS_STRING(peek(0));
   ObjString* a = AS_STRING(peek(1));
 
-  int length = a->length + b->length;
-  char* chars = ALLOCATE(char, length + 1);
-  memcpy(chars, a->chars, a->length);
-  memcpy(chars + a->length, b->chars, b->length);
-  chars[length] = '\0';
-
-  ObjString* result = takeString(chars, length);
+  ObjString* result = concatenateStrings(a, b);
   pop();
   pop();
   push(OBJ_VAL(result));
 }
 
+/**
+ * @brief 
+ * 把列表下标转换成 int：小整数直接使用，带小数的 double 返回 false；
+ * 超出 int 范围的整数转换成 -1，由调用方按越界处理
+ */
+static inline bool listIndex(Value value, int* index) {
+  if (IS_INT(value)) {
+    *index = AS_INT(value);
+    return true;
+  }
+  if (!IS_NUMBER(value)) return false;
+  double number = AS_NUMBER(value);
+  if (!(number >= INT32_MIN && number <= INT32_MAX)) {
+    *index = -1;
+    return number == number; // NaN 不是整数
+  }
+  *index = (int)number;
+  return number == *index;
+}
+
 /**
  * @brief 解释器执行逻辑，解析当前语句并执行
  * 
+ * 热路径上的 ip、栈顶和当前帧的 slots 都保存在 C 局部变量中（通常会分配到寄存器），
+ * 只在调用、返回、可能触发 GC 的分配以及运行时错误之前写回 CallFrame / VM，
+ * 这样 GC 的 markRoots() 和 runtimeError() 看到的仍然是正确的状态
+ * 
  * @return InterpretResult 
  */
 static InterpretResult run() {
-  CallFrame* frame = &vm.frames[vm.frameCount - 1];
-#define READ_BYTE() (*frame->ip++) // 读取下一个字节码指令
+  CallFrame* frame;
+  register uint8_t* ip; // 当前帧的指令指针，对应 frame->ip
+  register Value* stackTop; // 求值栈顶，对应 vm.stackTop
+  register Value* slots; // 当前帧的局部变量槽位，对应 frame->slots
+
+// 将局部变量中的状态写回 VM，调用可能分配内存或读取 VM 状态的函数之前使用
+#define STORE_FRAME() \
+    do { \
+      frame->ip = ip; \
+      vm.stackTop = stackTop; \
+    } while (false)
+// 从 VM 中重新读取当前帧的状态，调用/返回切换帧之后使用
+#define LOAD_FRAME() \
+    do { \
+      frame = &vm.frames[vm.frameCount - 1]; \
+      ip = frame->ip; \
+      slots = frame->slots; \
+      stackTop = vm.stackTop; \
+    } while (false)
+#define READ_BYTE() (*ip++) // 读取下一个字节码指令
 #define READ_SHORT() \
-    (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1])) // 读取下两个字节码指令，作为 short 返回
+    (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1])) // 读取下两个字节码指令，作为 short 返回
 #define READ_CONSTANT() \
     (frame->closure->function->chunk.constants.values[READ_BYTE()]) // 读取当前 Chunk 的下一个字节索引的常量
 #define READ_STRING() AS_STRING(READ_CONSTANT())
+#define READ_CACHE() \
+    (&frame->closure->function->chunk.caches[READ_SHORT()]) // 读取当前指令的内联缓存
+#define PUSH(value) (*stackTop++ = (value))
+#define POP() (*--stackTop)
+#define DROP() ((void)(--stackTop)) // 只弹出不取值
+#define PEEK(distance) (stackTop[-1 - (distance)])
+// 写回状态后抛出运行时异常，保证报错的行号和栈状态正确
+#define RUNTIME_ERROR(...) \
+    do { \
+      STORE_FRAME(); \
+      runtimeError(__VA_ARGS__); \
+      return INTERPRET_RUNTIME_ERROR; \
+    } while (false)
 // 执行 C 内置的二元运算符
 #define BINARY_OP(valueType, op) \
     do { \
-      if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-        runtimeError("Operands must be numbers."); \
-        return INTERPRET_RUNTIME_ERROR; \
+      if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+        RUNTIME_ERROR("Operands must be numbers."); \
+      } \
+      double b = AS_NUMBER(POP()); \
+      double a = AS_NUMBER(POP()); \
+      PUSH(valueType(a op b)); \
+    } while (false)
+// 两个操作数都是小整数时按整数计算并直接分发下一条指令，否则继续执行后面的 double 运算；
+// 加减法在 int64_t 中计算，由 intValue 检查结果是否还在 int32_t 范围内
+#define INT_BINARY_OP(valueType, op) \
+    do { \
+      if (IS_INT(PEEK(0)) && IS_INT(PEEK(1))) { \
+        int64_t b = AS_INT(POP()); \
+        PEEK(0) = valueType((int64_t)AS_INT(PEEK(0)) op b); \
+        DISPATCH(); \
       } \
-      double b = AS_NUMBER(pop()); \
-      double a = AS_NUMBER(pop()); \
-      push(valueType(a op b)); \
     } while (false)
 
-  for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
-    printf("          ");
-    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-      printf("[ ");
-      printValue(*slot);
-      printf(" ]");
-    }
-    printf("\n");
-    disassembleInstruction(
-      &frame->closure->function->chunk, 
-      (int)(frame->ip - frame->closure->function->chunk.code)
-    );
+#define TRACE_INSTRUCTION() \
+    do { \
+      printf("          "); \
+      for (Value* slot = vm.stack; slot < stackTop; slot++) { \
+        printf("[ "); \
+        printValue(*slot); \
+        printf(" ]"); \
+      } \
+      printf("\n"); \
+      disassembleInstruction( \
+        &frame->closure->function->chunk, \
+        (int)(ip - frame->closure->function->chunk.code) \
+      ); \
+    } while (false)
+#else
+#define TRACE_INSTRUCTION() do { } while (false)
+#endif
+
+// 循环和调用处是安全点，此时没有执行到一半的指令：
+// 分配时超过了堆的硬上限在这里报错，并发标记也在这里开始新一轮
+#ifdef GC_CONCURRENT
+#define GC_SAFEPOINT() \
+    do { \
+      if (vm.gcRequested) { \
+        STORE_FRAME(); \
+        beginConcurrentMark(); \
+      } \
+      HEAP_CHECK(); \
+    } while (false)
+#else
+#define GC_SAFEPOINT() HEAP_CHECK()
+#endif
+// 会分配内存的指令执行完之后也检查一次，报错的行号就是分配内存的那一行
+#define HEAP_CHECK() \
+    do { \
+      if (vm.heapExhausted) { \
+        STORE_FRAME(); \
+        heapLimitExceeded(); \
+        return INTERPRET_RUNTIME_ERROR; \
+      } \
+    } while (false)
+
+/**
+ * 指令分发：
+ * 支持 labels-as-values 时，每条指令执行完后直接通过标签表跳到下一条指令，
+ * 每个指令末尾都有各自的间接跳转，分支预测器可以按指令分别学习跳转目标；
+ * 否则退回到单一 switch 的分发方式。
+ * 两种方式共用同一套指令实现，区别只在 DISPATCH_LOOP / CASE / DISPATCH 三个宏
+ */
+#ifdef COMPUTED_GOTO
+  // 标签表，下标为 OpCode，与 chunk.h 中的枚举一一对应
+  static void* dispatchTable[] = {
+    [OP_CONSTANT]      = &&op_OP_CONSTANT,
+    [OP_NIL]           = &&op_OP_NIL,
+    [OP_TRUE]          = &&op_OP_TRUE,
+    [OP_FALSE]         = &&op_OP_FALSE,
+    [OP_POP]           = &&op_OP_POP,
+    [OP_GET_LOCAL]     = &&op_OP_GET_LOCAL,
+    [OP_SET_LOCAL]     = &&op_OP_SET_LOCAL,
+    [OP_GET_GLOBAL]    = &&op_OP_GET_GLOBAL,
+    [OP_DEFINE_GLOBAL] = &&op_OP_DEFINE_GLOBAL,
+    [OP_SET_GLOBAL]    = &&op_OP_SET_GLOBAL,
+    [OP_GET_UPVALUE]   = &&op_OP_GET_UPVALUE,
+    [OP_SET_UPVALUE]   = &&op_OP_SET_UPVALUE,
+    [OP_GET_PROPERTY]  = &&op_OP_GET_PROPERTY,
+    [OP_SET_PROPERTY]  = &&op_OP_SET_PROPERTY,
+    [OP_GET_SUPER]     = &&op_OP_GET_SUPER,
+    [OP_BUILD_LIST]    = &&op_OP_BUILD_LIST,
+    [OP_INDEX_GET]     = &&op_OP_INDEX_GET,
+    [OP_INDEX_SET]     = &&op_OP_INDEX_SET,
+    [OP_EQUAL]         = &&op_OP_EQUAL,
+    [OP_GREATER]       = &&op_OP_GREATER,
+    [OP_LESS]          = &&op_OP_LESS,
+    [OP_ADD]           = &&op_OP_ADD,
+    [OP_SUBTRACT]      = &&op_OP_SUBTRACT,
+    [OP_MULTIPLY]      = &&op_OP_MULTIPLY,
+    [OP_DIVIDE]        = &&op_OP_DIVIDE,
+    [OP_NOT]           = &&op_OP_NOT,
+    [OP_NEGATE]        = &&op_OP_NEGATE,
+    [OP_PRINT]         = &&op_OP_PRINT,
+    [OP_JUMP]          = &&op_OP_JUMP,
+    [OP_JUMP_IF_FALSE] = &&op_OP_JUMP_IF_FALSE,
+    [OP_LOOP]          = &&op_OP_LOOP,
+    [OP_CALL]          = &&op_OP_CALL,
+    [OP_INVOKE]        = &&op_OP_INVOKE,
+    [OP_SUPER_INVOKE]  = &&op_OP_SUPER_INVOKE,
+    [OP_CLOSURE]       = &&op_OP_CLOSURE,
+    [OP_CLOSE_UPVALUE] = &&op_OP_CLOSE_UPVALUE,
+    [OP_RETURN]        = &&op_OP_RETURN,
+    [OP_CLASS]         = &&op_OP_CLASS,
+    [OP_INHERIT]       = &&op_OP_INHERIT,
+    [OP_METHOD]        = &&op_OP_METHOD,
+  };
+
+#define DISPATCH_LOOP DISPATCH();
+#define CASE(name) op_##name
+#define DISPATCH() \
+    do { \
+      TRACE_INSTRUCTION(); \
+      goto *dispatchTable[READ_BYTE()]; \
+    } while (false)
+#else
+#define DISPATCH_LOOP \
+    dispatch: \
+      TRACE_INSTRUCTION(); \
+      switch (READ_BYTE())
+#define CASE(name) case name
+#define DISPATCH() goto dispatch
 #endif
-    uint8_t instruction;
-    switch (instruction = READ_BYTE()) {
-      case OP_CONSTANT: {
-        Value constant = READ_CONSTANT();
-        push(constant);
-        break;
+
+  LOAD_FRAME();
+
+  DISPATCH_LOOP {
+    CASE(OP_CONSTANT): {
+      Value constant = READ_CONSTANT();
+      PUSH(constant);
+      DISPATCH();
+    }
+    CASE(OP_NIL):      PUSH(NIL_VAL); DISPATCH();
+    CASE(OP_TRUE):     PUSH(BOOL_VAL(true)); DISPATCH();
+    CASE(OP_FALSE):    PUSH(BOOL_VAL(false)); DISPATCH();
+    CASE(OP_POP):      DROP(); DISPATCH();
+    CASE(OP_GET_LOCAL): {
+      uint8_t slot = READ_BYTE();
+      PUSH(slots[slot]); 
+      DISPATCH();
+    }
+    CASE(OP_SET_LOCAL): {
+      uint8_t slot = READ_BYTE();
+      slots[slot] = PEEK(0);
+      DISPATCH();
+    }
+    CASE(OP_GET_GLOBAL): {
+      Global* global = &vm.globals[READ_SHORT()];
+      if (!global->defined) {
+        RUNTIME_ERROR("Undefined variable '%s'.", global->name->chars);
       }
-      case OP_NIL:      push(NIL_VAL); break;
-      case OP_TRUE:     push(BOOL_VAL(true)); break;
-      case OP_FALSE:    push(BOOL_VAL(false)); break;
-      case OP_POP:      pop(); break;
-      case OP_GET_LOCAL: {
-        uint8_t slot = READ_BYTE();
-        push(frame->slots[slot]); 
-        break;
+      PUSH(global->value);
+      DISPATCH();
+    }
+    CASE(OP_DEFINE_GLOBAL): {
+      Global* global = &vm.globals[READ_SHORT()];
+      global->value = POP();
+      global->defined = true;
+      DISPATCH();
+    }
+    CASE(OP_SET_GLOBAL): {
+      Global* global = &vm.globals[READ_SHORT()];
+      if (!global->defined) {
+        RUNTIME_ERROR("Undefined variable '%s'.", global->name->chars);
       }
-      case OP_SET_LOCAL: {
-        uint8_t slot = READ_BYTE();
-        frame->slots[slot] = peek(0);
-        break;
+      global->value = PEEK(0);
+      DISPATCH();
+    }
+    CASE(OP_GET_UPVALUE): {
+      uint8_t slot = (uint8_t)READ_BYTE();
+      PUSH(*frame->closure->upvalues[slot]->location);
+      DISPATCH();
+    }
+    CASE(OP_SET_UPVALUE): {
+      uint8_t slot = READ_BYTE();
+      ObjUpvalue* upvalue = frame->closure->upvalues[slot];
+      preWriteBarrier((Obj*)upvalue);
+      *upvalue->location = PEEK(0);
+      writeBarrier((Obj*)upvalue, PEEK(0));
+      DISPATCH();
+    }
+    CASE(OP_GET_PROPERTY): {
+      if (!IS_INSTANCE(PEEK(0))) {
+        RUNTIME_ERROR("Only instances have properties.");
       }
-      case OP_GET_GLOBAL: {
-        ObjString* name = READ_STRING();
-        Value value;
-        if (!tableGet(&vm.globals, name, &value)) {
-          runtimeError("Undefined variable '%s'.", name->chars);
-          return INTERPRET_RUNTIME_ERROR;
+      ObjInstance* instance = AS_INSTANCE(PEEK(0));
+      ObjString* name = READ_STRING();
+      InlineCache* cache = READ_CACHE();
+
+      InlineCacheEntry* entry = findInlineCache(cache, instance->shape);
+      if (entry != NULL) {
+        cache->hits++;
+        if (entry->method == NULL) {
+          PEEK(0) = instance->fields[entry->index];
+        } else {
+          STORE_FRAME();
+          ObjBoundMethod* bound = newBoundMethod(PEEK(0), entry->method);
+          PEEK(0) = OBJ_VAL(bound);
         }
-        push(value);
-        break;
+        DISPATCH();
+      }
+
+      cache->misses++;
+      STORE_FRAME();
+      if (!getProperty(cache, instance, name)) {
+        return INTERPRET_RUNTIME_ERROR;
       }
-      case OP_DEFINE_GLOBAL: {
-        ObjString* name = READ_STRING();
-        tableSet(&vm.globals, name, peek(0));
-        pop();
-        break;
+      stackTop = vm.stackTop;
+      DISPATCH();
+    }
+    CASE(OP_SET_PROPERTY): {
+      if (!IS_INSTANCE(PEEK(1))) {
+        RUNTIME_ERROR("Only instances have fields.");
       }
-      case OP_SET_GLOBAL: {
-        ObjString* name = READ_STRING();
-        if (tableSet(&vm.globals, name, peek(0))) {
-          tableDelete(&vm.globals, name); 
-          runtimeError("Undefined variable '%s'.", name->chars);
-          return INTERPRET_RUNTIME_ERROR;
+      ObjInstance* instance = AS_INSTANCE(PEEK(1));
+      ObjString* name = READ_STRING();
+      InlineCache* cache = READ_CACHE();
+
+      InlineCacheEntry* entry = findInlineCache(cache, instance->shape);
+      if (entry != NULL) {
+        cache->hits++;
+        if (entry->transition == NULL) {
+          preWriteBarrier((Obj*)instance);
+          instance->fields[entry->index] = PEEK(0);
+          writeBarrier((Obj*)instance, PEEK(0));
+        } else {
+          STORE_FRAME();
+          instanceAddField(instance, entry->transition, PEEK(0));
         }
-        break;
+      } else {
+        cache->misses++;
+        STORE_FRAME();
+        setProperty(cache, instance, name, PEEK(0));
       }
-      case OP_GET_UPVALUE: {
-        uint8_t slot = (uint8_t)READ_BYTE();
-        push(*frame->closure->upvalues[slot]->location);
-        break;
+      Value value = POP();
+      PEEK(0) = value;
+      DISPATCH();
+    }
+    CASE(OP_GET_SUPER): {
+      ObjString* name = READ_STRING();
+      ObjClass* superclass = AS_CLASS(POP());
+
+      STORE_FRAME();
+      if (!bindMethod(superclass, name)) {
+        return INTERPRET_RUNTIME_ERROR;
       }
-      case OP_SET_UPVALUE: {
-        uint8_t slot = READ_BYTE();
-        *frame->closure->upvalues[slot]->location = peek(0);
-        break;
+      stackTop = vm.stackTop;
+      DISPATCH();
+    }
+    CASE(OP_BUILD_LIST): {
+      int count = READ_BYTE();
+      STORE_FRAME();
+      ObjList* list = newList();
+      PUSH(OBJ_VAL(list));
+      if (count > 0) {
+        // 分配元素数组时可能触发 GC，先让 GC 看到栈上的新列表
+        vm.stackTop = stackTop;
+        Value* values = GROW_ARRAY(Value, NULL, 0, count);
+        memcpy(values, stackTop - 1 - count, sizeof(Value) * count);
+        list->items.values = values;
+        list->items.capacity = count;
+        list->items.count = count;
+        // 列表可能在这次 GC 中晋升到了老年代
+        writeBarrierObject((Obj*)list);
       }
-      case OP_GET_PROPERTY: {
-        if (!IS_INSTANCE(peek(0))) {
-          runtimeError("Only instances have properties.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        ObjInstance* instance = AS_INSTANCE(peek(0));
-        ObjString* name = READ_STRING();
-
-        Value value;
-        if (tableGet(&instance->fields, name, &value)) {
-          pop(); // Instance.
-          push(value);
-          break;
-        }
-
-        if (!bindMethod(instance->klass, name)) {
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        break;
+      stackTop -= count + 1;
+      PUSH(OBJ_VAL(list));
+      HEAP_CHECK();
+      DISPATCH();
+    }
+    CASE(OP_INDEX_GET): {
+      if (!IS_LIST(PEEK(1))) {
+        RUNTIME_ERROR("Only lists can be indexed.");
       }
-      case OP_SET_PROPERTY: {
-        if (!IS_INSTANCE(peek(1))) {
-          runtimeError("Only instances have fields.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        ObjInstance* instance = AS_INSTANCE(peek(1));
-        tableSet(&instance->fields, READ_STRING(), peek(0));
-        Value value = pop();
-        pop();
-        push(value);
-        break;
+      ObjList* list = AS_LIST(PEEK(1));
+      int index;
+      if (!listIndex(PEEK(0), &index)) {
+        RUNTIME_ERROR("List index must be an integer.");
       }
-      case OP_GET_SUPER: {
-        ObjString* name = READ_STRING();
-        ObjClass* superclass = AS_CLASS(pop());
-
-        if (!bindMethod(superclass, name)) {
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        break;
+      if (index < 0 || index >= list->items.count) {
+        RUNTIME_ERROR("List index out of range.");
       }
-      case OP_EQUAL: {
-        Value b = pop();
-        Value a = pop();
-        push(BOOL_VAL(valuesEqual(a, b)));
-        break;
+      stackTop--;
+      PEEK(0) = list->items.values[index];
+      DISPATCH();
+    }
+    CASE(OP_INDEX_SET): {
+      if (!IS_LIST(PEEK(2))) {
+        RUNTIME_ERROR("Only lists can be indexed.");
       }
-      case OP_GREATER:  BINARY_OP(BOOL_VAL, >); break;
-      case OP_LESS:     BINARY_OP(BOOL_VAL, <); break;
-      case OP_ADD: {
-        if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-          concatenate();
-        } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-          double b = AS_NUMBER(pop());
-          double a = AS_NUMBER(pop());
-          push(NUMBER_VAL(a + b));
-        } else {
-          runtimeError(
-              "Operands must be two numbers or two strings.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        break;
+      ObjList* list = AS_LIST(PEEK(2));
+      int index;
+      if (!listIndex(PEEK(1), &index)) {
+        RUNTIME_ERROR("List index must be an integer.");
       }
-      case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break;
-      case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
-      case OP_DIVIDE:   BINARY_OP(NUMBER_VAL, /); break;
-      case OP_NOT:
-        push(BOOL_VAL(isFalsey(pop())));
-        break;
-      case OP_NEGATE:
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(-AS_NUMBER(pop())));
-        break;
-      case OP_PRINT: {
-        printValue(pop());
-        printf("\n");
-        break;
+      if (index < 0 || index >= list->items.count) {
+        RUNTIME_ERROR("List index out of range.");
       }
-      case OP_JUMP: {
-        uint16_t offset = READ_SHORT();
-        frame->ip += offset;
-        break;
+      preWriteBarrier((Obj*)list);
+      list->items.values[index] = PEEK(0);
+      writeBarrier((Obj*)list, PEEK(0));
+      // 赋值表达式的值是写入的值
+      Value value = POP();
+      stackTop--;
+      PEEK(0) = value;
+      DISPATCH();
+    }
+    CASE(OP_EQUAL): {
+      // 比较字符串可能要展开 rope 并分配内存，写回状态，比较完之前两个操作数留在栈上
+      if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1))) {
+        STORE_FRAME();
+        bool equal = stringsEqual(AS_STRING(PEEK(1)), AS_STRING(PEEK(0)));
+        stackTop--;
+        PEEK(0) = BOOL_VAL(equal);
+        DISPATCH();
       }
-      case OP_JUMP_IF_FALSE: {
-        uint16_t offset = READ_SHORT();
-        if (isFalsey(peek(0))) frame->ip += offset;
-        break;
+      Value b = POP();
+      Value a = POP();
+      PUSH(BOOL_VAL(valuesEqual(a, b)));
+      DISPATCH();
+    }
+    CASE(OP_GREATER):
+      INT_BINARY_OP(BOOL_VAL, >);
+      BINARY_OP(BOOL_VAL, >);
+      DISPATCH();
+    CASE(OP_LESS):
+      INT_BINARY_OP(BOOL_VAL, <);
+      BINARY_OP(BOOL_VAL, <);
+      DISPATCH();
+    CASE(OP_ADD): {
+      INT_BINARY_OP(intValue, +);
+      if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1))) {
+        STORE_FRAME();
+        concatenate();
+        stackTop = vm.stackTop;
+        HEAP_CHECK();
+      } else if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+        double b = AS_NUMBER(POP());
+        double a = AS_NUMBER(POP());
+        PUSH(NUMBER_VAL(a + b));
+      } else {
+        RUNTIME_ERROR(
+            "Operands must be two numbers or two strings.");
       }
-      case OP_LOOP: {
-        uint16_t offset = READ_SHORT();
-        frame->ip -= offset;
-        break;
+      DISPATCH();
+    }
+    CASE(OP_SUBTRACT):
+      INT_BINARY_OP(intValue, -);
+      BINARY_OP(NUMBER_VAL, -);
+      DISPATCH();
+    CASE(OP_MULTIPLY):
+      // 0 乘以负数得到 -0，只有 double 能表示：两个操作数都不为 0 或者都不是负数时才按整数计算
+      if (IS_INT(PEEK(0)) && IS_INT(PEEK(1)) &&
+          ((AS_INT(PEEK(0)) != 0 && AS_INT(PEEK(1)) != 0) ||
+           (AS_INT(PEEK(0)) >= 0 && AS_INT(PEEK(1)) >= 0))) {
+        int64_t b = AS_INT(POP());
+        PEEK(0) = intValue((int64_t)AS_INT(PEEK(0)) * b);
+        DISPATCH();
       }
-      case OP_CALL: {
-        int argCount = READ_BYTE();
-        if (!callValue(peek(argCount), argCount)) {
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        frame = &vm.frames[vm.frameCount - 1];
-        break;
+      BINARY_OP(NUMBER_VAL, *);
+      DISPATCH();
+    // 除法的结果通常不是整数，总是按 double 计算
+    CASE(OP_DIVIDE):   BINARY_OP(NUMBER_VAL, /); DISPATCH();
+    CASE(OP_NOT):
+      PEEK(0) = BOOL_VAL(isFalsey(PEEK(0)));
+      DISPATCH();
+    CASE(OP_NEGATE):
+      // -0 只有 double 能表示，交给后面的 double 运算
+      if (IS_INT(PEEK(0)) && AS_INT(PEEK(0)) != 0) {
+        PEEK(0) = intValue(-(int64_t)AS_INT(PEEK(0)));
+        DISPATCH();
       }
-      case OP_INVOKE: {
-        ObjString* method = READ_STRING();
-        int argCount = READ_BYTE();
-        if (!invoke(method, argCount)) {
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        frame = &vm.frames[vm.frameCount - 1];
-        break;
+      if (!IS_NUMBER(PEEK(0))) {
+        RUNTIME_ERROR("Operand must be a number.");
       }
-      case OP_SUPER_INVOKE: {
-        ObjString* method = READ_STRING();
-        int argCount = READ_BYTE();
-        ObjClass* superclass = AS_CLASS(pop());
-        if (!invokeFromClass(superclass, method, argCount)) {
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        frame = &vm.frames[vm.frameCount - 1];
-        break;
+      PEEK(0) = NUMBER_VAL(-AS_NUMBER(PEEK(0)));
+      DISPATCH();
+    CASE(OP_PRINT): {
+      printValue(POP());
+      printf("\n");
+      DISPATCH();
+    }
+    CASE(OP_JUMP): {
+      uint16_t offset = READ_SHORT();
+      ip += offset;
+      DISPATCH();
+    }
+    CASE(OP_JUMP_IF_FALSE): {
+      uint16_t offset = READ_SHORT();
+      if (isFalsey(PEEK(0))) ip += offset;
+      DISPATCH();
+    }
+    CASE(OP_LOOP): {
+      uint16_t offset = READ_SHORT();
+      GC_SAFEPOINT();
+      ip -= offset;
+      DISPATCH();
+    }
+    CASE(OP_CALL): {
+      int argCount = READ_BYTE();
+      GC_SAFEPOINT();
+      STORE_FRAME();
+      if (!callValue(PEEK(argCount), argCount)) {
+        return INTERPRET_RUNTIME_ERROR;
       }
-      case OP_CLOSURE: {
-        ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
-        ObjClosure* closure = newClosure(function);
-        push(OBJ_VAL(closure));
-        // 创建闭包中所有 upvalue 的引用
-        for (int i = 0; i < closure->upvalueCount; i++) {
-          uint8_t isLocal = READ_BYTE();
-          uint8_t index = READ_BYTE();
-          if (isLocal) {
-            closure->upvalues[i] = captureUpvalue(frame->slots + index);
-          } else {
-            closure->upvalues[i] = frame->closure->upvalues[index];
-          }
-        }
-        break;
+      LOAD_FRAME();
+      DISPATCH();
+    }
+    CASE(OP_INVOKE): {
+      ObjString* method = READ_STRING();
+      int argCount = READ_BYTE();
+      InlineCache* cache = READ_CACHE();
+      GC_SAFEPOINT();
+      STORE_FRAME();
+      if (!invoke(cache, method, argCount)) {
+        return INTERPRET_RUNTIME_ERROR;
       }
-      case OP_CLOSE_UPVALUE:
-        closeUpvalues(vm.stackTop - 1);
-        pop();
-        break;
-      case OP_RETURN: {
-        Value result = pop();
-        closeUpvalues(frame->slots);
-        vm.frameCount--;
-        // 此时整个脚本已经执行结束，pop 掉全局函数这个临时变量
-        if (vm.frameCount == 0) {
-          pop();
-          return INTERPRET_OK;
-        }
-
-        // 将求值栈顶和 CallFrame 的栈顶同步，这样可以清理掉参数列表
-        vm.stackTop = frame->slots;
-        push(result);
-        frame = &vm.frames[vm.frameCount - 1];
-        break;
+      LOAD_FRAME();
+      DISPATCH();
+    }
+    CASE(OP_SUPER_INVOKE): {
+      ObjString* method = READ_STRING();
+      int argCount = READ_BYTE();
+      ObjClass* superclass = AS_CLASS(POP());
+      STORE_FRAME();
+      if (!invokeFromClass(superclass, method, argCount)) {
+        return INTERPRET_RUNTIME_ERROR;
       }
-      case OP_CLASS:
-        push(OBJ_VAL(newClass(READ_STRING())));
-        break;
-      case OP_INHERIT: {
-        Value superclass = peek(1);
-        if (!IS_CLASS(superclass)) {
-          runtimeError("Superclass must be a class.");
-          return INTERPRET_RUNTIME_ERROR;
+      LOAD_FRAME();
+      DISPATCH();
+    }
+    CASE(OP_CLOSURE): {
+      ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
+      STORE_FRAME();
+      ObjClosure* closure = newClosure(function);
+      PUSH(OBJ_VAL(closure));
+      // captureUpvalue 可能触发 GC，需要先让 GC 看到栈上的新闭包
+      vm.stackTop = stackTop;
+      // 创建闭包中所有 upvalue 的引用
+      for (int i = 0; i < closure->upvalueCount; i++) {
+        uint8_t isLocal = READ_BYTE();
+        uint8_t index = READ_BYTE();
+        if (isLocal) {
+          closure->upvalues[i] = captureUpvalue(slots + index);
+        } else {
+          closure->upvalues[i] = frame->closure->upvalues[index];
         }
-        ObjClass* subclass = AS_CLASS(peek(0));
-        tableAddAll(&AS_CLASS(superclass)->methods, &subclass->methods);
-        pop(); // Subclass.
-        break;
       }
-      case OP_METHOD:
-        defineMethod(READ_STRING());
-        break;
+      // 闭包可能在 captureUpvalue 触发的 GC 中晋升到了老年代
+      writeBarrierObject((Obj*)closure);
+      HEAP_CHECK();
+      DISPATCH();
+    }
+    CASE(OP_CLOSE_UPVALUE):
+      closeUpvalues(stackTop - 1);
+      DROP();
+      DISPATCH();
+    CASE(OP_RETURN): {
+      // 脚本结束之前最后检查一次，之后不再有安全点
+      if (vm.frameCount == 1) HEAP_CHECK();
+      Value result = POP();
+      closeUpvalues(slots);
+      vm.frameCount--;
+      // 此时整个脚本已经执行结束，pop 掉全局函数这个临时变量
+      if (vm.frameCount == 0) {
+        DROP();
+        vm.stackTop = stackTop;
+        return INTERPRET_OK;
+      }
+
+      // 将求值栈顶和 CallFrame 的栈顶同步，这样可以清理掉参数列表
+      stackTop = slots;
+      PUSH(result);
+      vm.stackTop = stackTop;
+      LOAD_FRAME();
+      DISPATCH();
+    }
+    CASE(OP_CLASS): {
+      ObjString* name = READ_STRING();
+      STORE_FRAME();
+      PUSH(OBJ_VAL(newClass(name)));
+      HEAP_CHECK();
+      DISPATCH();
+    }
+    CASE(OP_INHERIT): {
+      Value superclass = PEEK(1);
+      if (!IS_CLASS(superclass)) {
+        RUNTIME_ERROR("Superclass must be a class.");
+      }
+      ObjClass* subclass = AS_CLASS(PEEK(0));
+      STORE_FRAME();
+      preWriteBarrier((Obj*)subclass);
+      tableAddAll(&AS_CLASS(superclass)->methods, &subclass->methods);
+      writeBarrierObject((Obj*)subclass);
+      DROP(); // Subclass.
+      DISPATCH();
+    }
+    CASE(OP_METHOD): {
+      ObjString* name = READ_STRING();
+      STORE_FRAME();
+      defineMethod(name);
+      stackTop = vm.stackTop;
+      DISPATCH();
     }
   }
 
+  // 只有 switch 分发遇到未知的操作码时才会离开循环
+  RUNTIME_ERROR("Unknown opcode %d.", ip[-1]);
+
 #undef READ_BYTE
 #undef READ_SHORT
 #undef READ_CONSTANT
 #undef READ_STRING
+#undef READ_CACHE
+#undef PUSH
+#undef POP
+#undef DROP
+#undef PEEK
+#undef RUNTIME_ERROR
+#undef STORE_FRAME
+#undef LOAD_FRAME
 #undef BINARY_OP
+#undef INT_BINARY_OP
+#undef TRACE_INSTRUCTION
+#undef GC_SAFEPOINT
+#undef HEAP_CHECK
+#undef DISPATCH_LOOP
+#undef CASE
+#undef DISPATCH
 }
 
 InterpretResult interpret(const char* source) {
+  // 上一次执行因为其他错误中止时可能留下了标记，由这一次的分配重新检查
+  vm.heapExhausted = false;
   ObjFunction* function = compile(source);
   if (function == NULL) return INTERPRET_COMPILE_ERROR;
+  if (heapLimitExceeded()) return INTERPRET_RUNTIME_ERROR;
 
   push(OBJ_VAL(function));
   ObjClosure* closure = newClosure(function);
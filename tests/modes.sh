@@ -0,0 +1,41 @@
+#!/bin/sh
+# 分别用 NaN boxing 和带类型标签的结构体两种 Value 表示构建 clox，
+# 逐个运行 tests/ 下的脚本，两种构建的输出必须完全一致
+#
+# 用法: tests/modes.sh [CFLAGS]
+# CFLAGS 同时用于两种构建，例如：
+#   tests/modes.sh "-DGC_INCREMENTAL -fsanitize=address"
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${BUILD_DIR:-$ROOT/build-modes}
+FLAGS=${1:-}
+
+for mode in ON OFF; do
+  cmake -S "$ROOT" -B "$BUILD/nan-$mode" -DCLOX_NAN_BOXING=$mode \
+      -DCMAKE_C_FLAGS="$FLAGS" > /dev/null
+  cmake --build "$BUILD/nan-$mode" > /dev/null
+done
+
+failed=0
+for script in "$ROOT"/tests/*.lox; do
+  # 输出计时的脚本每次结果都不同，无法比较
+  if grep -q "clock()" "$script"; then
+    echo "skip  $(basename "$script")"
+    continue
+  fi
+  # 脚本开头的 "// flags: ..." 是额外的命令行选项，"// exit: N" 是预期的退出码
+  flags=$(sed -n 's|^// flags: ||p' "$script")
+  status=$(sed -n 's|^// exit: ||p' "$script")
+  expected=$("$BUILD/nan-OFF/bin/clox" $flags "$script" 2>&1 && echo "exit 0" || echo "exit $?")
+  actual=$("$BUILD/nan-ON/bin/clox" $flags "$script" 2>&1 && echo "exit 0" || echo "exit $?")
+  if [ "$expected" = "$actual" ] && \
+      [ "${expected##*exit }" = "${status:-${expected##*exit }}" ]; then
+    echo "ok    $(basename "$script")"
+  else
+    echo "FAIL  $(basename "$script")"
+    failed=1
+  fi
+done
+exit $failed
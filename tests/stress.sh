@@ -0,0 +1,42 @@
+#!/bin/sh
+# 打开 DEBUG_STRESS_GC 构建 clox，逐个运行 tests/ 下的脚本，
+# 输出必须和普通构建完全一致
+#
+# 用法: tests/stress.sh [CFLAGS]
+# 默认压力测试并发标记，例如：
+#   tests/stress.sh "-DGC_CONCURRENT -fsanitize=thread"
+#   tests/stress.sh "-DGC_INCREMENTAL -fsanitize=address"
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${BUILD_DIR:-$ROOT/build-stress}
+FLAGS=${1:--DGC_CONCURRENT}
+
+cmake -S "$ROOT" -B "$BUILD/base" > /dev/null
+cmake --build "$BUILD/base" > /dev/null
+cmake -S "$ROOT" -B "$BUILD/stress" -DCMAKE_BUILD_TYPE=Debug \
+    -DCMAKE_C_FLAGS="-DDEBUG_STRESS_GC $FLAGS" > /dev/null
+cmake --build "$BUILD/stress" > /dev/null
+
+failed=0
+for script in "$ROOT"/tests/*.lox; do
+  # 输出计时的脚本每次结果都不同，无法比较
+  if grep -q "clock()" "$script"; then
+    echo "skip  $(basename "$script")"
+    continue
+  fi
+  # 脚本开头的 "// flags: ..." 是额外的命令行选项，"// exit: N" 是预期的退出码
+  flags=$(sed -n 's|^// flags: ||p' "$script")
+  status=$(sed -n 's|^// exit: ||p' "$script")
+  expected=$("$BUILD/base/bin/clox" $flags "$script" 2>&1 && echo "exit 0" || echo "exit $?")
+  actual=$("$BUILD/stress/bin/clox" $flags "$script" 2>&1 && echo "exit 0" || echo "exit $?")
+  if [ "$expected" = "$actual" ] && \
+      [ "${expected##*exit }" = "${status:-${expected##*exit }}" ]; then
+    echo "ok    $(basename "$script")"
+  else
+    echo "FAIL  $(basename "$script")"
+    failed=1
+  fi
+done
+exit $failed